@@ -0,0 +1,110 @@
+// Times a fixed one-hour get_range against stores holding more and more
+// history, to show that the cost of a range query depends on the range, not
+// on the retention.
+//
+//   blinky-storage-bench [interval_seconds] [days...]
+//
+// Defaults: one sample every 60 seconds, retentions of 1, 7, 30 and 90 days.
+
+#include "local_storage.h"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+using namespace blinky;
+
+namespace {
+
+constexpr int QUERY_RUNS = 50;
+constexpr uint64_t START_TS = 1700000000;
+
+metrics::SystemMetrics make_sample(uint64_t timestamp, uint64_t i) {
+    metrics::SystemMetrics sample;
+    sample.timestamp = timestamp;
+    sample.hostname = "bench-host";
+    sample.uptime_seconds = timestamp - START_TS;
+    sample.cpu.usage_percent = static_cast<double>(i % 100);
+    sample.cpu.load_1min = 0.5 + (i % 10) * 0.1;
+    sample.cpu.core_count = 8;
+    sample.memory.total_bytes = 16ull << 30;
+    sample.memory.used_bytes = (4ull << 30) + (i % 1000) * 4096;
+    for (int d = 0; d < 2; ++d) {
+        metrics::DiskMetrics disk;
+        disk.device = "/dev/sda" + std::to_string(d + 1);
+        disk.mount_point = d == 0 ? "/" : "/var";
+        disk.total_bytes = 500ull << 30;
+        disk.used_bytes = (100ull << 30) + i * 512;
+        sample.disks.push_back(disk);
+    }
+    metrics::NetworkMetrics net;
+    net.interface = "eth0";
+    net.rx_bytes = i * 1500;
+    net.tx_bytes = i * 900;
+    sample.network.push_back(net);
+    return sample;
+}
+
+// Fills a fresh store with days of samples and returns the median time of
+// a one-hour range query from the middle of it, in microseconds.
+double run(const std::string& dir, uint64_t interval, uint64_t days, size_t& segments, size_t& returned) {
+    std::filesystem::remove_all(dir);
+
+    agent::LocalStorage storage(dir, 1000000, 1, 0, agent::SyncOptions(), {}, 0);
+    uint64_t samples = days * 86400 / interval;
+    for (uint64_t i = 0; i < samples; ++i) {
+        auto sample = make_sample(START_TS + i * interval, i);
+        while (!storage.store(sample)) {
+            storage.flush();
+        }
+    }
+    storage.flush();
+    segments = storage.get_stats().segments;
+
+    time_t start = static_cast<time_t>(START_TS + samples * interval / 2);
+    std::vector<double> times;
+    for (int run = 0; run < QUERY_RUNS; ++run) {
+        auto began = std::chrono::steady_clock::now();
+        returned = storage.get_range(start, start + 3600).size();
+        times.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - began).count());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+}
+
+int main(int argc, char** argv) {
+    uint64_t interval = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 60;
+    std::vector<uint64_t> retentions;
+    for (int i = 2; i < argc; ++i) {
+        retentions.push_back(std::strtoull(argv[i], nullptr, 10));
+    }
+    if (interval == 0) {
+        interval = 60;
+    }
+    if (retentions.empty()) {
+        retentions = {1, 7, 30, 90};
+    }
+
+    std::string dir = (std::filesystem::temp_directory_path() / "blinky-storage-bench").string();
+
+    std::cout << "One-hour get_range, one sample every " << interval << " s, median of "
+              << QUERY_RUNS << " runs\n\n";
+    std::cout << std::setw(6) << "days" << std::setw(10) << "samples" << std::setw(10) << "segments"
+              << std::setw(10) << "returned" << std::setw(12) << "query us" << "\n";
+
+    for (uint64_t days : retentions) {
+        size_t segments = 0;
+        size_t returned = 0;
+        double micros = run(dir, interval, days, segments, returned);
+        std::cout << std::setw(6) << days << std::setw(10) << days * 86400 / interval
+                  << std::setw(10) << segments << std::setw(10) << returned
+                  << std::setw(12) << std::fixed << std::setprecision(1) << micros << "\n";
+    }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "metrics.h"
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+namespace blinky {
+namespace agent {
+
+// Lets API requests (GET /metrics/now) ask the collection loop, which owns
+// the monitors, for a sample ahead of schedule. Requests arriving while a
+// collection is pending or running wait for that one rather than start
+// their own, and a sample younger than min_spacing is handed out as it is,
+// so a burst of callers costs at most one extra collection per
+// min_spacing.
+class CollectTrigger {
+public:
+    using Sample = std::shared_ptr<const metrics::SystemMetrics>;
+    using Clock = std::chrono::steady_clock;
+
+    explicit CollectTrigger(std::chrono::milliseconds min_spacing)
+        : min_spacing_(min_spacing) {
+    }
+
+    CollectTrigger(const CollectTrigger&) = delete;
+    CollectTrigger& operator=(const CollectTrigger&) = delete;
+
+    // Called by API threads. Returns a sample at most min_spacing old, or
+    // null if none arrived within timeout or the agent is shutting down.
+    Sample request(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (latest_ && Clock::now() - latest_at_ < min_spacing_) {
+            return latest_;
+        }
+
+        uint64_t wanted = completed_ + 1;
+        if (!collecting_ && !requested_) {
+            requested_ = true;
+            wake_loop_.notify_one();
+        }
+        bool done = collected_.wait_for(lock, timeout, [this, wanted] {
+            return completed_ >= wanted || stopped_;
+        });
+        return done && completed_ >= wanted ? latest_ : nullptr;
+    }
+
+    // Called by the collection loop between samples. Sleeps until deadline
+    // or an on-demand request; true if a request is waiting.
+    bool wait(Clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_loop_.wait_until(lock, deadline, [this] { return requested_ || stopped_; });
+        return requested_ && !stopped_;
+    }
+
+    // Brackets a collection, scheduled or not. Requests arriving in between
+    // are answered by it.
+    void begin() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        requested_ = false;
+        collecting_ = true;
+    }
+
+    void complete(const metrics::SystemMetrics& sample) {
+        auto shared = std::make_shared<const metrics::SystemMetrics>(sample);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            latest_ = std::move(shared);
+            latest_at_ = Clock::now();
+            collecting_ = false;
+            ++completed_;
+        }
+        collected_.notify_all();
+    }
+
+    // Releases waiting requests and the loop.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        collected_.notify_all();
+        wake_loop_.notify_all();
+    }
+
+private:
+    std::chrono::milliseconds min_spacing_;
+    std::mutex mutex_;
+    std::condition_variable wake_loop_;
+    std::condition_variable collected_;
+    Sample latest_;
+    Clock::time_point latest_at_;
+    uint64_t completed_ = 0;
+    bool requested_ = false;
+    bool collecting_ = false;
+    bool stopped_ = false;
+};
+
+}
+}
@@ -91,9 +91,22 @@ public:
     void initialize();
     metrics::SystemMetrics collectAll();
     
+    // Re-reads only the monitors that work from /proc and /sys (CPU, memory,
+    // disks, network, temperatures). SMART, systemd, container and
+    // Kubernetes data, which need external commands, are carried over from
+    // the last collectAll().
+    metrics::SystemMetrics collectFast();
+    
+    const metrics::SystemInfo& systemInfo() const;
+    
 private:
+    // Host inventory rarely changes, so it is re-read only every N samples.
+    static const uint64_t SYSTEM_INFO_REFRESH_SAMPLES = 720;
+    
     metrics::SystemMetrics current_metrics_;
+    uint64_t samples_collected_ = 0;
     std::vector<std::unique_ptr<Monitor>> monitors_;
+    std::vector<Monitor*> fast_monitors_;
 };
 
 }
@@ -0,0 +1,444 @@
+#pragma once
+
+#include "segment.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace blinky {
+namespace agent {
+namespace columnar {
+
+// Column file written next to each sealed segment (segment-N.col). Every
+// numeric series of the samples in the segment is stored as its own column,
+// so a query for one series reads only that column and the shared time
+// column. Integers are little-endian:
+//
+//   header     "BLKYCOL1" | u32 format version | u32 reserved
+//   columns    time column, then one value column per series
+//   directory  u32 string count | (u32 length | bytes)...
+//              u32 point count | u64 time offset | u32 time size
+//              u32 column count | (u32 path string | u32 labels string |
+//                                  u64 offset | u32 size)...
+//   trailer    u64 directory offset | u32 directory size | u32 reserved |
+//              "BLKYCEND"
+//
+// Timestamps use delta-of-delta encoding and values XOR encoding, as in
+// Facebook's Gorilla paper. Each value column holds one value per sample;
+// samples in which the series is absent (a disk that was unmounted) hold
+// NaN. Series paths and labels are stored once in the string dictionary.
+
+constexpr char HEADER_MAGIC[] = "BLKYCOL1";
+constexpr char TRAILER_MAGIC[] = "BLKYCEND";
+constexpr uint32_t FORMAT_VERSION = 1;
+constexpr size_t HEADER_SIZE = 16;
+constexpr size_t TRAILER_SIZE = 24;
+
+inline std::string column_file_path(const std::string& segment_path) {
+    return segment_path.substr(0, segment_path.size() - 4) + ".col";
+}
+
+class BitWriter {
+public:
+    void write(uint64_t value, int bits) {
+        for (int i = bits - 1; i >= 0; --i) {
+            if (used_ == 0) {
+                bytes_.push_back(0);
+            }
+            if ((value >> i) & 1) {
+                bytes_.back() |= static_cast<char>(0x80 >> used_);
+            }
+            used_ = (used_ + 1) & 7;
+        }
+    }
+
+    const std::string& bytes() const { return bytes_; }
+
+private:
+    std::string bytes_;
+    int used_ = 0;
+};
+
+class BitReader {
+public:
+    explicit BitReader(std::string_view data) : data_(data) {}
+
+    // Reads past the end return zero bits; callers know the point count.
+    uint64_t read(int bits) {
+        uint64_t value = 0;
+        for (int i = 0; i < bits; ++i) {
+            size_t byte = pos_ >> 3;
+            int bit = byte < data_.size() ? (static_cast<uint8_t>(data_[byte]) >> (7 - (pos_ & 7))) & 1 : 0;
+            value = (value << 1) | static_cast<uint64_t>(bit);
+            ++pos_;
+        }
+        return value;
+    }
+
+private:
+    std::string_view data_;
+    size_t pos_ = 0;
+};
+
+// Delta-of-delta timestamps: the first timestamp in 64 bits, the first delta
+// in 32, then each change of delta with a variable-length prefix. A regular
+// sampling interval costs one bit per point.
+class TimestampEncoder {
+public:
+    void add(uint64_t ts) {
+        if (count_ == 0) {
+            bits_.write(ts, 64);
+        } else if (count_ == 1) {
+            delta_ = static_cast<int64_t>(ts - prev_);
+            bits_.write(static_cast<uint32_t>(delta_), 32);
+        } else {
+            int64_t delta = static_cast<int64_t>(ts - prev_);
+            int64_t dod = delta - delta_;
+            delta_ = delta;
+
+            if (dod == 0) {
+                bits_.write(0, 1);
+            } else if (dod >= -63 && dod <= 64) {
+                bits_.write(0b10, 2);
+                bits_.write(static_cast<uint64_t>(dod + 63), 7);
+            } else if (dod >= -255 && dod <= 256) {
+                bits_.write(0b110, 3);
+                bits_.write(static_cast<uint64_t>(dod + 255), 9);
+            } else if (dod >= -2047 && dod <= 2048) {
+                bits_.write(0b1110, 4);
+                bits_.write(static_cast<uint64_t>(dod + 2047), 12);
+            } else {
+                bits_.write(0b1111, 4);
+                bits_.write(static_cast<uint32_t>(dod), 32);
+            }
+        }
+        prev_ = ts;
+        ++count_;
+    }
+
+    const std::string& bytes() const { return bits_.bytes(); }
+
+private:
+    BitWriter bits_;
+    uint64_t prev_ = 0;
+    int64_t delta_ = 0;
+    size_t count_ = 0;
+};
+
+inline std::vector<uint64_t> decode_timestamps(std::string_view data, size_t count) {
+    std::vector<uint64_t> result;
+    result.reserve(count);
+    BitReader bits(data);
+
+    uint64_t prev = 0;
+    int64_t delta = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (i == 0) {
+            prev = bits.read(64);
+        } else if (i == 1) {
+            delta = static_cast<int32_t>(bits.read(32));
+            prev += delta;
+        } else {
+            int64_t dod;
+            if (bits.read(1) == 0) {
+                dod = 0;
+            } else if (bits.read(1) == 0) {
+                dod = static_cast<int64_t>(bits.read(7)) - 63;
+            } else if (bits.read(1) == 0) {
+                dod = static_cast<int64_t>(bits.read(9)) - 255;
+            } else if (bits.read(1) == 0) {
+                dod = static_cast<int64_t>(bits.read(12)) - 2047;
+            } else {
+                dod = static_cast<int32_t>(bits.read(32));
+            }
+            delta += dod;
+            prev += delta;
+        }
+        result.push_back(prev);
+    }
+    return result;
+}
+
+inline uint64_t double_bits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline double bits_double(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// XOR value compression: a repeated value costs one bit; otherwise only the
+// meaningful bits of the XOR with the previous value are stored, reusing
+// the previous leading/trailing zero window when it still fits.
+class ValueEncoder {
+public:
+    void add(double value) {
+        uint64_t bits = double_bits(value);
+
+        if (count_++ == 0) {
+            bits_.write(bits, 64);
+            prev_ = bits;
+            return;
+        }
+
+        uint64_t x = bits ^ prev_;
+        prev_ = bits;
+
+        if (x == 0) {
+            bits_.write(0, 1);
+            return;
+        }
+
+        int leading = std::min(__builtin_clzll(x), 31);
+        int trailing = __builtin_ctzll(x);
+
+        if (leading_ >= 0 && leading >= leading_ && trailing >= trailing_) {
+            bits_.write(0b10, 2);
+            bits_.write(x >> trailing_, 64 - leading_ - trailing_);
+        } else {
+            int meaningful = 64 - leading - trailing;
+            bits_.write(0b11, 2);
+            bits_.write(static_cast<uint64_t>(leading), 5);
+            bits_.write(static_cast<uint64_t>(meaningful - 1), 6);
+            bits_.write(x >> trailing, meaningful);
+            leading_ = leading;
+            trailing_ = trailing;
+        }
+    }
+
+    const std::string& bytes() const { return bits_.bytes(); }
+
+private:
+    BitWriter bits_;
+    uint64_t prev_ = 0;
+    int leading_ = -1;
+    int trailing_ = 0;
+    size_t count_ = 0;
+};
+
+inline std::vector<double> decode_values(std::string_view data, size_t count) {
+    std::vector<double> result;
+    result.reserve(count);
+    BitReader bits(data);
+
+    uint64_t prev = 0;
+    int leading = 0;
+    int trailing = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (i == 0) {
+            prev = bits.read(64);
+        } else if (bits.read(1) != 0) {
+            if (bits.read(1) != 0) {
+                leading = static_cast<int>(bits.read(5));
+                int meaningful = static_cast<int>(bits.read(6)) + 1;
+                trailing = 64 - leading - meaningful;
+            }
+            prev ^= bits.read(64 - leading - trailing) << trailing;
+        }
+        result.push_back(bits_double(prev));
+    }
+    return result;
+}
+
+// Accumulates samples in timestamp order and produces a column file.
+class ColumnBuilder {
+public:
+    void add(uint64_t timestamp, const std::map<std::pair<std::string, std::string>, double>& values) {
+        for (const auto& entry : values) {
+            auto it = columns_.find(entry.first);
+            if (it == columns_.end()) {
+                it = columns_.emplace(entry.first, ValueEncoder()).first;
+                for (size_t i = 0; i < points_; ++i) {
+                    it->second.add(NAN);
+                }
+            }
+        }
+
+        for (auto& column : columns_) {
+            auto value = values.find(column.first);
+            column.second.add(value != values.end() ? value->second : NAN);
+        }
+
+        times_.add(timestamp);
+        ++points_;
+    }
+
+    size_t size() const { return points_; }
+
+    std::string finish() const {
+        std::string out(HEADER_MAGIC, 8);
+        segment::put_le(out, FORMAT_VERSION, 4);
+        segment::put_le(out, 0, 4);
+
+        uint64_t time_offset = out.size();
+        out += times_.bytes();
+
+        std::vector<std::string> strings;
+        std::map<std::string, uint32_t> string_ids;
+        auto intern = [&](const std::string& s) {
+            auto it = string_ids.find(s);
+            if (it != string_ids.end()) {
+                return it->second;
+            }
+            uint32_t id = static_cast<uint32_t>(strings.size());
+            strings.push_back(s);
+            string_ids.emplace(s, id);
+            return id;
+        };
+
+        std::string entries;
+        for (const auto& column : columns_) {
+            segment::put_le(entries, intern(column.first.first), 4);
+            segment::put_le(entries, intern(column.first.second), 4);
+            segment::put_le(entries, out.size(), 8);
+            segment::put_le(entries, column.second.bytes().size(), 4);
+            out += column.second.bytes();
+        }
+
+        uint64_t directory_offset = out.size();
+        segment::put_le(out, strings.size(), 4);
+        for (const auto& s : strings) {
+            segment::put_le(out, s.size(), 4);
+            out += s;
+        }
+        segment::put_le(out, points_, 4);
+        segment::put_le(out, time_offset, 8);
+        segment::put_le(out, times_.bytes().size(), 4);
+        segment::put_le(out, columns_.size(), 4);
+        out += entries;
+
+        uint64_t directory_size = out.size() - directory_offset;
+        segment::put_le(out, directory_offset, 8);
+        segment::put_le(out, directory_size, 4);
+        segment::put_le(out, 0, 4);
+        out.append(TRAILER_MAGIC, 8);
+        return out;
+    }
+
+private:
+    TimestampEncoder times_;
+    std::map<std::pair<std::string, std::string>, ValueEncoder> columns_;
+    size_t points_ = 0;
+};
+
+struct Point {
+    uint64_t timestamp;
+    double value;
+};
+
+// Reads the points of every series with the given path whose timestamps lie
+// in [start, end], keyed by labels. Only the directory, the time column and
+// the matching value columns are read from disk.
+inline bool read_series(const std::string& path, const std::string& series, uint64_t start, uint64_t end,
+                        std::map<std::string, std::vector<Point>>& result) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    char trailer[TRAILER_SIZE];
+    bool ok = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= HEADER_SIZE + TRAILER_SIZE &&
+              segment::read_exact(fd, trailer, TRAILER_SIZE, st.st_size - TRAILER_SIZE) &&
+              std::memcmp(trailer + 16, TRAILER_MAGIC, 8) == 0;
+
+    uint64_t directory_offset = ok ? segment::get_le(trailer, 8) : 0;
+    size_t directory_size = ok ? segment::get_le(trailer + 8, 4) : 0;
+    ok = ok && directory_offset + directory_size + TRAILER_SIZE == static_cast<uint64_t>(st.st_size);
+
+    std::string directory(directory_size, '\0');
+    ok = ok && segment::read_exact(fd, &directory[0], directory_size, directory_offset);
+
+    // Bounds-checked cursor over the directory.
+    size_t pos = 0;
+    auto take = [&](int bytes) -> uint64_t {
+        if (!ok || directory.size() - pos < static_cast<size_t>(bytes)) {
+            ok = false;
+            return 0;
+        }
+        uint64_t value = segment::get_le(directory.data() + pos, bytes);
+        pos += bytes;
+        return value;
+    };
+
+    // Every count is checked against the bytes that have to hold its items
+    // before anything is allocated for them: a string takes at least its
+    // 4-byte length, a column entry 20 bytes, and a point at least one bit
+    // of the time column and of every value column.
+    size_t string_count = take(4);
+    if (string_count > (directory.size() - pos) / 4) {
+        ok = false;
+    }
+    std::vector<std::string_view> strings(ok ? string_count : 0);
+    for (auto& s : strings) {
+        size_t len = take(4);
+        if (!ok || directory.size() - pos < len) {
+            ok = false;
+            break;
+        }
+        s = std::string_view(directory.data() + pos, len);
+        pos += len;
+    }
+
+    size_t points = take(4);
+    uint64_t time_offset = take(8);
+    size_t time_size = take(4);
+    size_t column_count = take(4);
+    ok = ok && column_count <= (directory.size() - pos) / 20 && time_offset >= HEADER_SIZE &&
+         time_offset <= directory_offset && time_size <= directory_offset - time_offset &&
+         points <= static_cast<uint64_t>(time_size) * 8;
+
+    std::vector<uint64_t> timestamps;
+    for (size_t i = 0; ok && i < column_count; ++i) {
+        size_t path_id = take(4);
+        size_t labels_id = take(4);
+        uint64_t offset = take(8);
+        size_t size = take(4);
+        if (!ok || path_id >= strings.size() || labels_id >= strings.size() || offset < HEADER_SIZE ||
+            offset > directory_offset || size > directory_offset - offset ||
+            points > static_cast<uint64_t>(size) * 8) {
+            ok = false;
+            break;
+        }
+        if (strings[path_id] != series) {
+            continue;
+        }
+
+        if (timestamps.empty()) {
+            std::string data(time_size, '\0');
+            ok = segment::read_exact(fd, &data[0], time_size, time_offset);
+            timestamps = decode_timestamps(data, points);
+        }
+
+        std::string data(size, '\0');
+        ok = ok && segment::read_exact(fd, &data[0], size, offset);
+        if (!ok) {
+            break;
+        }
+
+        auto values = decode_values(data, points);
+        auto first = std::lower_bound(timestamps.begin(), timestamps.end(), start);
+        auto& out = result[std::string(strings[labels_id])];
+        for (auto it = first; it != timestamps.end() && *it <= end; ++it) {
+            double value = values[it - timestamps.begin()];
+            if (!std::isnan(value)) {
+                out.push_back({*it, value});
+            }
+        }
+    }
+
+    close(fd);
+    return ok;
+}
+
+}
+}
+}
@@ -1,23 +1,78 @@
 #pragma once
 
 #include "local_storage.h"
+#include "metrics_schema.h"
+#include "cached_buffer.h"
+#include "http_encoding.h"
 #include <string>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <cstring>
+#include <cstdio>
 #include <sstream>
+#include <ctime>
 
 namespace blinky {
 namespace agent {
 
+// Where the API accepts connections. The TCP listener is off when the port
+// is 0. Peers on the unix socket are identified with SO_PEERCRED: root and
+// the agent's own user are always let in, others only if their uid or
+// primary gid is listed.
+struct ListenOptions {
+    std::string bind_address = "0.0.0.0";
+    std::string unix_socket;
+    std::vector<uid_t> allowed_uids;
+    std::vector<gid_t> allowed_gids;
+};
+
+// HTTP/1.1 server for the pull API. One thread runs a non-blocking epoll
+// loop over all connections: it accepts, reads and parses requests
+// incrementally, and writes responses as the sockets accept them.
+// Connections are kept alive and pipelined requests are answered in order.
+// Cheap requests (/health, /stats, /metrics) are answered on the loop
+// thread; history reads go to a small worker pool so they cannot hold up
+// the others, as do /metrics/now requests waiting for a fresh sample.
+// Sample lists are streamed with chunked encoding: the worker hands the
+// loop pieces of a fixed size and waits while a slow client leaves too
+// many of them unsent, so memory stays bounded whatever the size of the
+// response. /metrics/stream subscribers get every new sample as
+// a Server-Sent Event. Clients accepting gzip get compressed bodies; the
+// cached snapshots are compressed once per sample, streams as they go.
 class HttpApi {
 public:
-    HttpApi(LocalStorage& storage, int port = 9092)
+    // gzip_level is the zlib compression level, 1 (fastest) to 9; 0 turns
+    // compression off.
+    HttpApi(LocalStorage& storage, int port = 9092, size_t workers = 2, int interval_seconds = 5,
+            int gzip_level = 6, ListenOptions listen = ListenOptions())
         : storage_(storage)
         , port_(port)
+        , listen_(std::move(listen))
+        , worker_count_(workers > 0 ? workers : 1)
+        , interval_seconds_(interval_seconds > 0 ? interval_seconds : 1)
+        , gzip_level_(std::min(std::max(gzip_level, 0), 9))
+        , etag_prefix_(std::to_string(std::time(nullptr)) + "-")
         , running_(false)
         , server_fd_(-1) {
     }
@@ -31,30 +86,27 @@ public:
             return false;
         }
 
-        server_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-        if (server_fd_ < 0) {
-            return false;
-        }
-
-        int opt = 1;
-        setsockopt(server_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-        struct sockaddr_in address;
-        address.sin_family = AF_INET;
-        address.sin_addr.s_addr = INADDR_ANY;
-        address.sin_port = htons(port_);
-
-        if (bind(server_fd_, (struct sockaddr*)&address, sizeof(address)) < 0) {
-            close(server_fd_);
+        if ((port_ <= 0 && listen_.unix_socket.empty()) ||
+            (port_ > 0 && !open_tcp_listener()) ||
+            (!listen_.unix_socket.empty() && !open_unix_listener())) {
+            close_descriptors();
             return false;
         }
 
-        if (listen(server_fd_, 10) < 0) {
-            close(server_fd_);
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll_fd_ < 0 || wake_fd_ < 0 || !watch(wake_fd_, EPOLLIN, EPOLL_CTL_ADD) ||
+            (server_fd_ >= 0 && !watch(server_fd_, EPOLLIN, EPOLL_CTL_ADD)) ||
+            (unix_fd_ >= 0 && !watch(unix_fd_, EPOLLIN, EPOLL_CTL_ADD))) {
+            close_descriptors();
             return false;
         }
 
         running_ = true;
+        workers_stopping_ = false;
+        for (size_t i = 0; i < worker_count_; ++i) {
+            workers_.emplace_back(&HttpApi::worker_loop, this);
+        }
         server_thread_ = std::thread(&HttpApi::run, this);
 
         return true;
@@ -66,128 +118,1277 @@ public:
         }
 
         running_ = false;
-        
-        if (server_fd_ >= 0) {
-            close(server_fd_);
-            server_fd_ = -1;
-        }
-
+        wake();
         if (server_thread_.joinable()) {
             server_thread_.join();
         }
+
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex_);
+            workers_stopping_ = true;
+        }
+        jobs_ready_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+        workers_.clear();
+        jobs_.clear();
+        completed_.clear();
+
+        for (auto& entry : connections_) {
+            close(entry.first);
+        }
+        connections_.clear();
+        subscribers_ = 0;
+        close_descriptors();
     }
 
     bool is_running() const {
         return running_;
     }
 
+    // Source of on-demand samples for /metrics/now; it may block until the
+    // sample is collected. Set before start().
+    void set_collect_now(std::function<std::shared_ptr<const metrics::SystemMetrics>()> collect_now) {
+        collect_now_ = std::move(collect_now);
+    }
+
     int get_port() const {
         return port_;
     }
 
+    const std::string& get_unix_socket() const {
+        return listen_.unix_socket;
+    }
+
+    // Called once per collection tick. Serializes the sample and renders the
+    // Prometheus exposition once, so /metrics and scrapes only copy the
+    // cached buffers to the socket, and hands the sample to the loop for the
+    // /metrics/stream subscribers.
+    void publish_sample(const metrics::SystemMetrics& sample) {
+        std::string text;
+        text.reserve(16384);
+        metrics::schema::writePrometheus(text, {&sample});
+        prometheus_.publish(std::move(text));
+        latest_.publish(sample.toJSON());
+        published_at_ = std::chrono::steady_clock::now().time_since_epoch().count();
+
+        if (subscribers_.load(std::memory_order_relaxed) > 0) {
+            {
+                std::lock_guard<std::mutex> lock(sample_mutex_);
+                next_sample_ = std::make_shared<const metrics::SystemMetrics>(sample);
+            }
+            wake();
+        }
+    }
+
 private:
+    using Body = std::shared_ptr<const std::string>;
+
+    // Writes a response body to a sink, on a worker thread.
+    using Producer = std::function<bool(const LocalStorage::JsonSink&)>;
+
+    // Pieces of a streamed body on their way from the worker producing it to
+    // the loop sending it.
+    struct Stream {
+        std::mutex mutex;
+        std::condition_variable writable;
+        std::vector<Body> pieces;   // framed chunks not yet queued on the connection
+        size_t pending = 0;         // bytes in pieces
+        size_t queued = 0;          // bytes queued on the connection and not yet sent
+        bool finished = false;
+        bool failed = false;        // the body is incomplete; close instead of ending it
+        bool cancelled = false;     // the connection is gone
+    };
+
+    struct Response {
+        int status = 200;
+        std::string content_type;
+        Body body;
+        Producer producer;                // streamed instead of body when set
+        std::shared_ptr<Stream> stream;
+        std::string etag;
+        int max_age = -1;                 // seconds a client may reuse the body; none if negative
+        std::string content_encoding;     // of body, or to apply to the stream
+        bool vary = false;                // the encoding depends on Accept-Encoding
+    };
+
+    // Pending output of a connection: response headers and bodies in the
+    // order they are to be sent. Bodies are shared, not copied.
+    struct Chunk {
+        Body data;
+        size_t offset = 0;
+    };
+
+    // What a /metrics/stream client asked for.
+    struct Subscription {
+        std::string query;          // identifies subscribers wanting the same events
+        metrics::schema::Projection projection;
+    };
+
+    struct Connection {
+        uint64_t id = 0;
+        std::string in;
+        std::deque<Chunk> out;
+        size_t queued = 0;          // unsent bytes in out
+        std::shared_ptr<Stream> stream;
+        bool stream_keep_alive = false;
+        std::shared_ptr<const Subscription> subscription;
+        Body next_event;            // newest event waiting for the previous one to be sent
+        std::chrono::steady_clock::time_point last_event;   // last event or heartbeat queued
+        bool busy = false;          // a worker is answering the current request
+        bool forbidden = false;     // unix socket peer not allowed; refuse its first request
+        bool closing = false;       // close once the queued responses are sent
+        bool read_closed = false;   // the client shut down its side
+        uint32_t events = 0;
+        std::chrono::steady_clock::time_point last_active;
+    };
+
+    struct Job {
+        int fd;
+        uint64_t id;
+        std::string path;
+        std::string head;
+        bool keep_alive;
+        bool chunked;               // the client understands chunked encoding
+        Response response;
+    };
+
+    static constexpr size_t MAX_REQUEST_SIZE = 16 * 1024;
+    static constexpr size_t STREAM_BACKLOG = 4 * LocalStorage::STREAM_CHUNK_SIZE;
+    static constexpr size_t MAX_EVENTS = 64;
+    static constexpr size_t MAX_LATEST_COUNT = 100000;
+    static constexpr std::chrono::seconds IDLE_TIMEOUT{60};
+    static constexpr std::chrono::seconds HEARTBEAT_INTERVAL{15};
+
     LocalStorage& storage_;
     int port_;
+    ListenOptions listen_;
+    size_t worker_count_;
+    int interval_seconds_;
+    int gzip_level_;
+    std::string etag_prefix_;           // tells apart the versions of earlier runs
     std::atomic<bool> running_;
     int server_fd_;
+    int unix_fd_ = -1;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
     std::thread server_thread_;
+    CachedBuffer prometheus_;
+    CachedBuffer latest_;
+    std::function<std::shared_ptr<const metrics::SystemMetrics>()> collect_now_;
+    std::atomic<std::chrono::steady_clock::rep> published_at_{0};
+
+    // Only touched by the loop thread.
+    std::unordered_map<int, Connection> connections_;
+    uint64_t next_connection_id_ = 0;
+
+    // Requests handed to the workers and their answers on the way back.
+    std::mutex jobs_mutex_;
+    std::condition_variable jobs_ready_;
+    std::deque<Job> jobs_;
+    std::vector<Job> completed_;
+    std::vector<std::thread> workers_;
+    bool workers_stopping_ = false;
+
+    // Samples for the /metrics/stream subscribers. Only the newest one is
+    // kept: a loop that falls behind skips to it.
+    std::atomic<size_t> subscribers_{0};
+    std::mutex sample_mutex_;
+    std::shared_ptr<const metrics::SystemMetrics> next_sample_;
+
+    void close_descriptors() {
+        if (unix_fd_ >= 0) {
+            unlink(listen_.unix_socket.c_str());
+        }
+        for (int* fd : {&server_fd_, &unix_fd_, &epoll_fd_, &wake_fd_}) {
+            if (*fd >= 0) {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+
+    bool open_tcp_listener() {
+        struct sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port_);
+        if (inet_pton(AF_INET, listen_.bind_address.c_str(), &address.sin_addr) != 1) {
+            return false;
+        }
+
+        server_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (server_fd_ < 0) {
+            return false;
+        }
+
+        int opt = 1;
+        setsockopt(server_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+        return bind(server_fd_, (struct sockaddr*)&address, sizeof(address)) == 0 &&
+               listen(server_fd_, SOMAXCONN) == 0;
+    }
+
+    // The socket file is world-writable; who may talk to the API is decided
+    // per connection from the peer's credentials. A socket left behind by an
+    // earlier run is replaced, any other file at the path is not.
+    bool open_unix_listener() {
+        const std::string& path = listen_.unix_socket;
+        struct sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                return false;
+            }
+            unlink(path.c_str());
+        }
+
+        unix_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (unix_fd_ < 0) {
+            return false;
+        }
+
+        if (bind(unix_fd_, (struct sockaddr*)&address, sizeof(address)) != 0) {
+            close(unix_fd_);
+            unix_fd_ = -1;
+            return false;
+        }
+        return chmod(path.c_str(), 0666) == 0 && listen(unix_fd_, SOMAXCONN) == 0;
+    }
+
+    bool peer_allowed(int fd) const {
+        struct ucred cred;
+        socklen_t length = sizeof(cred);
+        if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &length) != 0) {
+            return false;
+        }
+        return cred.uid == 0 || cred.uid == geteuid() ||
+               std::find(listen_.allowed_uids.begin(), listen_.allowed_uids.end(), cred.uid) != listen_.allowed_uids.end() ||
+               std::find(listen_.allowed_gids.begin(), listen_.allowed_gids.end(), cred.gid) != listen_.allowed_gids.end();
+    }
+
+    bool watch(int fd, uint32_t events, int op) {
+        struct epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        return epoll_ctl(epoll_fd_, op, fd, &event) == 0;
+    }
+
+    void wake() {
+        uint64_t one = 1;
+        if (write(wake_fd_, &one, sizeof(one)) < 0) {
+            // The counter is already non-zero; the loop will wake anyway
+        }
+    }
 
     void run() {
+        struct epoll_event events[MAX_EVENTS];
+        auto last_sweep = std::chrono::steady_clock::now();
+
         while (running_) {
-            struct sockaddr_in client_addr;
-            socklen_t client_len = sizeof(client_addr);
-            
-            int client_fd = accept(server_fd_, (struct sockaddr*)&client_addr, &client_len);
+            int count = epoll_wait(epoll_fd_, events, MAX_EVENTS, 1000);
+            if (count < 0 && errno != EINTR) {
+                break;
+            }
+
+            for (int i = 0; i < count; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == server_fd_ || fd == unix_fd_) {
+                    accept_connections(fd);
+                } else if (fd == wake_fd_) {
+                    uint64_t value;
+                    if (read(wake_fd_, &value, sizeof(value)) < 0) {
+                        // Nothing to drain
+                    }
+                    deliver_completed();
+                    pump_streams();
+                    send_events();
+                } else {
+                    handle_event(fd, events[i].events);
+                }
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - last_sweep >= std::chrono::seconds(1)) {
+                close_idle_connections(now);
+                send_heartbeats(now);
+                last_sweep = now;
+            }
+        }
+    }
+
+    void accept_connections(int listen_fd) {
+        while (true) {
+            int client_fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
             if (client_fd < 0) {
-                if (running_) {
+                if (errno == EINTR || errno == ECONNABORTED) {
                     continue;
+                }
+                return;
+            }
+
+            bool forbidden = false;
+            if (listen_fd == unix_fd_) {
+                forbidden = !peer_allowed(client_fd);
+            } else {
+                int opt = 1;
+                setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+            }
+
+            Connection& conn = connections_[client_fd];
+            conn = Connection();
+            conn.id = ++next_connection_id_;
+            conn.forbidden = forbidden;
+            conn.last_active = std::chrono::steady_clock::now();
+            conn.events = EPOLLIN | EPOLLRDHUP;
+            if (!watch(client_fd, conn.events, EPOLL_CTL_ADD)) {
+                close_connection(client_fd);
+            }
+        }
+    }
+
+    void handle_event(int fd, uint32_t events) {
+        auto it = connections_.find(fd);
+        if (it == connections_.end()) {
+            return;
+        }
+
+        Connection& conn = it->second;
+        conn.last_active = std::chrono::steady_clock::now();
+
+        // A hang-up means the client can no longer receive either.
+        bool keep = (events & (EPOLLERR | EPOLLHUP)) == 0;
+        if (keep && (events & (EPOLLIN | EPOLLRDHUP))) {
+            keep = read_available(fd, conn);
+        }
+        if (keep) {
+            process_requests(fd, conn);
+            keep = conn.stream ? pump_stream(fd, conn) : flush(fd, conn);
+        }
+
+        if (!keep) {
+            close_connection(fd);
+        }
+    }
+
+    // Reads everything the socket has. Returns false if the connection
+    // failed or sent more than a request may hold.
+    bool read_available(int fd, Connection& conn) {
+        char buffer[16384];
+        while (true) {
+            ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+            if (n > 0) {
+                conn.in.append(buffer, n);
+                if (conn.in.size() > 4 * MAX_REQUEST_SIZE) {
+                    return false;
+                }
+                continue;
+            }
+            if (n == 0) {
+                conn.read_closed = true;
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+    }
+
+    // Answers the complete requests at the front of the input, in order.
+    // Stops at a request handed to a worker until its answer is queued, so
+    // pipelined responses keep their order.
+    void process_requests(int fd, Connection& conn) {
+        while (!conn.busy && !conn.closing && !conn.subscription) {
+            size_t head_end = conn.in.find("\r\n\r\n");
+            if (head_end == std::string::npos) {
+                if (conn.in.size() > MAX_REQUEST_SIZE) {
+                    queue_response(conn, make_response(400, "Request too large", "text/plain"), false);
+                }
+                return;
+            }
+
+            std::string head = conn.in.substr(0, head_end + 2);
+            size_t content_length = 0;
+            try {
+                std::string value = get_header(head, "content-length");
+                content_length = value.empty() ? 0 : std::stoul(value);
+            } catch (...) {
+                content_length = MAX_REQUEST_SIZE + 1;
+            }
+            if (head_end > MAX_REQUEST_SIZE || content_length > MAX_REQUEST_SIZE) {
+                queue_response(conn, make_response(400, "Request too large", "text/plain"), false);
+                return;
+            }
+
+            size_t request_size = head_end + 4 + content_length;
+            if (conn.in.size() < request_size) {
+                return;
+            }
+            conn.in.erase(0, request_size);
+
+            std::string method, path, version;
+            parse_request_line(head, method, path, version);
+
+            std::string connection = get_header(head, "connection");
+            std::transform(connection.begin(), connection.end(), connection.begin(),
+                           [](unsigned char c) { return std::tolower(c); });
+            bool keep_alive = version == "HTTP/1.1" ? connection != "close" : connection == "keep-alive";
+
+            if (conn.forbidden) {
+                queue_response(conn, make_response(403, "Forbidden", "text/plain"), false);
+            } else if (method != "GET") {
+                queue_response(conn, make_response(405, "Method Not Allowed", "text/plain"), keep_alive);
+            } else if (path.substr(0, path.find('?')) == "/metrics/stream") {
+                subscribe(conn, path);
+            } else if (is_expensive(path)) {
+                conn.busy = true;
+                {
+                    std::lock_guard<std::mutex> lock(jobs_mutex_);
+                    jobs_.push_back(Job{fd, conn.id, path, head, keep_alive, version == "HTTP/1.1", Response()});
+                }
+                jobs_ready_.notify_one();
+            } else {
+                queue_response(conn, dispatch(path, head), keep_alive);
+            }
+        }
+    }
+
+    // GET /metrics/stream: Server-Sent Events, one per collected sample,
+    // each holding the sample as /metrics returns it. The query selects
+    // fields as for /metrics. The response lasts until the client closes
+    // the connection.
+    void subscribe(Connection& conn, const std::string& path) {
+        auto subscription = std::make_shared<Subscription>();
+        size_t query = path.find('?');
+        subscription->query = query == std::string::npos ? "" : path.substr(query + 1);
+        subscription->projection = metrics::schema::parseProjection(path);
+        conn.subscription = subscription;
+        conn.last_event = std::chrono::steady_clock::now();
+        conn.in.clear();
+        subscribers_.fetch_add(1, std::memory_order_relaxed);
+
+        push_output(conn, std::make_shared<const std::string>(
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/event-stream\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Access-Control-Allow-Origin: *\r\n"
+            "Connection: close\r\n"
+            "\r\n"));
+
+        // Start with the newest sample rather than leave the client waiting
+        // for the next one.
+        const auto& projection = subscription->projection;
+        std::string latest = storage_.get_latest_json(1, projection.selectsAll() ? nullptr : &projection);
+        if (latest != "{}") {
+            push_output(conn, make_event(latest));
+        }
+    }
+
+    static Body make_event(std::string_view json) {
+        std::string event;
+        event.reserve(json.size() + 8);
+        event += "data: ";
+        event.append(json);
+        event += "\n\n";
+        return std::make_shared<const std::string>(std::move(event));
+    }
+
+    // Sends the newest sample to every subscriber. It is serialized once per
+    // distinct selection. A subscriber still receiving an earlier event gets
+    // the new one after it, replacing any event already waiting, so a slow
+    // client skips samples instead of falling further behind.
+    void send_events() {
+        std::shared_ptr<const metrics::SystemMetrics> sample;
+        {
+            std::lock_guard<std::mutex> lock(sample_mutex_);
+            sample.swap(next_sample_);
+        }
+        if (!sample) {
+            return;
+        }
+
+        std::unordered_map<std::string, Body> events;
+        std::vector<int> failed;
+        for (auto& entry : connections_) {
+            Connection& conn = entry.second;
+            if (!conn.subscription) {
+                continue;
+            }
+
+            auto it = events.find(conn.subscription->query);
+            if (it == events.end()) {
+                Body event;
+                Body latest = latest_.get();
+                if (conn.subscription->projection.selectsAll() && latest) {
+                    event = make_event(*latest);
                 } else {
-                    break;
+                    std::string json;
+                    json.reserve(4096);
+                    if (metrics::schema::writeProjectedJSON(json, *sample, conn.subscription->projection)) {
+                        event = make_event(json);
+                    }
                 }
+                it = events.emplace(conn.subscription->query, event).first;
+            }
+            if (!it->second) {
+                continue;  // filtered out
+            }
+
+            conn.next_event = it->second;
+            conn.last_event = std::chrono::steady_clock::now();
+            if (!flush(entry.first, conn)) {
+                failed.push_back(entry.first);
             }
+        }
+        for (int fd : failed) {
+            close_connection(fd);
+        }
+    }
+
+    // Sends a comment line to subscribers that got nothing for
+    // HEARTBEAT_INTERVAL, because the interval is long or their filter
+    // matched no sample, so clients and proxies with a read timeout keep
+    // the stream open. Clients ignore lines starting with ':'.
+    void send_heartbeats(std::chrono::steady_clock::time_point now) {
+        static const Body heartbeat = std::make_shared<const std::string>(":\n\n");
 
-            handle_request(client_fd);
-            close(client_fd);
+        std::vector<int> failed;
+        for (auto& entry : connections_) {
+            Connection& conn = entry.second;
+            if (!conn.subscription || !conn.out.empty() || conn.next_event ||
+                now - conn.last_event < HEARTBEAT_INTERVAL) {
+                continue;
+            }
+            conn.last_event = now;
+            push_output(conn, heartbeat);
+            if (!flush(entry.first, conn)) {
+                failed.push_back(entry.first);
+            }
+        }
+        for (int fd : failed) {
+            close_connection(fd);
         }
     }
 
-    void handle_request(int client_fd) {
-        char buffer[4096];
-        ssize_t bytes_read = recv(client_fd, buffer, sizeof(buffer) - 1, 0);
-        
-        if (bytes_read <= 0) {
+    // History reads may touch many segments on disk.
+    static bool is_expensive(const std::string& path) {
+        return path.rfind("/metrics/latest", 0) == 0 || path.rfind("/metrics/series", 0) == 0 ||
+               path.rfind("/metrics/range", 0) == 0 || path.rfind("/metrics/now", 0) == 0;
+    }
+
+    void worker_loop() {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(jobs_mutex_);
+                jobs_ready_.wait(lock, [this] { return workers_stopping_ || !jobs_.empty(); });
+                if (workers_stopping_) {
+                    return;
+                }
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+
+            job.response = dispatch(job.path, job.head);
+
+            Producer producer = std::move(job.response.producer);
+            job.response.producer = nullptr;
+            bool gzip = job.response.content_encoding == "gzip";
+            if (producer && !job.chunked) {
+                std::string body;
+                run_producer(producer, gzip, [&body](std::string&& piece) {
+                    body += piece;
+                    return true;
+                });
+                job.response.body = std::make_shared<const std::string>(std::move(body));
+                producer = nullptr;
+            }
+
+            std::shared_ptr<Stream> stream;
+            if (producer) {
+                stream = std::make_shared<Stream>();
+                job.response.stream = stream;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(jobs_mutex_);
+                completed_.push_back(std::move(job));
+            }
+            wake();
+
+            if (stream) {
+                produce_stream(producer, gzip, *stream);
+            }
+        }
+    }
+
+    // Runs a producer, compressing what it writes on the way to sink if
+    // asked to.
+    bool run_producer(const Producer& producer, bool gzip, const LocalStorage::JsonSink& sink) {
+        try {
+            if (!gzip) {
+                return producer(sink);
+            }
+
+            http::GzipEncoder encoder(gzip_level_);
+            std::string out;
+            bool ok = producer([&encoder, &out, &sink](std::string&& piece) {
+                if (!encoder.write(piece, out)) {
+                    return false;
+                }
+                if (out.empty()) {
+                    return true;
+                }
+                bool accepted = sink(std::move(out));
+                out.clear();
+                return accepted;
+            });
+            return ok && encoder.finish(out) && sink(std::move(out));
+        } catch (...) {
+            return false;
+        }
+    }
+
+    // Runs a producer on the worker thread, framing each piece as a chunk.
+    // Blocks while STREAM_BACKLOG bytes are waiting to be sent, until the
+    // client catches up or the connection is closed.
+    void produce_stream(const Producer& producer, bool gzip, Stream& stream) {
+        static const Body crlf = std::make_shared<const std::string>("\r\n");
+
+        auto append = [this, &stream](std::vector<Body> framed, size_t size) {
+            std::unique_lock<std::mutex> lock(stream.mutex);
+            while (!stream.cancelled && running_ && stream.pending + stream.queued >= STREAM_BACKLOG) {
+                stream.writable.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            if (stream.cancelled || !running_) {
+                return false;
+            }
+            for (auto& piece : framed) {
+                stream.pieces.push_back(std::move(piece));
+            }
+            stream.pending += size;
+            lock.unlock();
+            wake();
+            return true;
+        };
+
+        bool complete = run_producer(producer, gzip, [&append](std::string&& piece) {
+            if (piece.empty()) {
+                return true;  // an empty chunk would end the body
+            }
+            char size_line[32];
+            int length = snprintf(size_line, sizeof(size_line), "%zx\r\n", piece.size());
+            size_t size = length + piece.size() + crlf->size();
+            return append({std::make_shared<const std::string>(size_line, length),
+                           std::make_shared<const std::string>(std::move(piece)), crlf}, size);
+        });
+
+        if (complete) {
+            complete = append({std::make_shared<const std::string>("0\r\n\r\n")}, 5);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            stream.finished = true;
+            stream.failed = !complete;
+        }
+        wake();
+    }
+
+    void deliver_completed() {
+        std::vector<Job> completed;
+        {
+            std::lock_guard<std::mutex> lock(jobs_mutex_);
+            completed.swap(completed_);
+        }
+
+        for (auto& job : completed) {
+            auto it = connections_.find(job.fd);
+            if (it == connections_.end() || it->second.id != job.id) {
+                // The client went away meanwhile
+                if (job.response.stream) {
+                    cancel_stream(*job.response.stream);
+                }
+                continue;
+            }
+
+            Connection& conn = it->second;
+            bool keep;
+            if (job.response.stream) {
+                queue_response(conn, job.response, job.keep_alive);
+                keep = pump_stream(job.fd, conn);
+            } else {
+                conn.busy = false;
+                queue_response(conn, job.response, job.keep_alive);
+                process_requests(job.fd, conn);
+                keep = flush(job.fd, conn);
+            }
+            if (!keep) {
+                close_connection(job.fd);
+            }
+        }
+    }
+
+    // Streamed responses are few, so the connections are simply searched.
+    void pump_streams() {
+        std::vector<int> failed;
+        for (auto& entry : connections_) {
+            if (entry.second.stream && !pump_stream(entry.first, entry.second)) {
+                failed.push_back(entry.first);
+            }
+        }
+        for (int fd : failed) {
+            close_connection(fd);
+        }
+    }
+
+    // Queues the pieces the worker has produced, sends what the socket
+    // takes and tells the worker how much is still unsent. Ends the
+    // response once the worker is done with it.
+    bool pump_stream(int fd, Connection& conn) {
+        Stream& stream = *conn.stream;
+        bool finished, failed;
+        {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            for (auto& piece : stream.pieces) {
+                conn.queued += piece->size();
+                conn.out.push_back(Chunk{std::move(piece), 0});
+            }
+            stream.pieces.clear();
+            stream.pending = 0;
+            finished = stream.finished;
+            failed = stream.failed;
+        }
+
+        if (finished) {
+            conn.stream.reset();
+            conn.busy = false;
+            if (failed) {
+                // The body is cut short: closing the connection tells the
+                // client so, where a final chunk would not.
+                conn.closing = true;
+                conn.in.clear();
+            } else if (!conn.stream_keep_alive) {
+                conn.closing = true;
+            }
+            process_requests(fd, conn);
+            return flush(fd, conn);
+        }
+
+        bool keep = flush(fd, conn);
+        {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            stream.queued = conn.queued;
+        }
+        stream.writable.notify_one();
+        return keep;
+    }
+
+    static void cancel_stream(Stream& stream) {
+        {
+            std::lock_guard<std::mutex> lock(stream.mutex);
+            stream.cancelled = true;
+        }
+        stream.writable.notify_one();
+    }
+
+    void queue_response(Connection& conn, const Response& response, bool keep_alive) {
+        std::ostringstream header;
+        header << "HTTP/1.1 " << response.status << " " << get_status_text(response.status) << "\r\n";
+        if (!response.content_type.empty()) {
+            header << "Content-Type: " << response.content_type << "\r\n";
+        }
+        if (response.stream) {
+            header << "Transfer-Encoding: chunked\r\n";
+        } else if (response.status != 304) {
+            header << "Content-Length: " << response.body->size() << "\r\n";
+        }
+        if (!response.content_encoding.empty()) {
+            header << "Content-Encoding: " << response.content_encoding << "\r\n";
+        }
+        if (response.vary) {
+            header << "Vary: Accept-Encoding\r\n";
+        }
+        if (!response.etag.empty()) {
+            header << "ETag: " << response.etag << "\r\n";
+        }
+        if (response.max_age >= 0) {
+            header << "Cache-Control: max-age=" << response.max_age << "\r\n";
+        }
+        header << "Access-Control-Allow-Origin: *\r\n";
+        header << "Connection: " << (keep_alive ? "keep-alive" : "close") << "\r\n";
+        header << "\r\n";
+
+        push_output(conn, std::make_shared<const std::string>(header.str()));
+        if (response.stream) {
+            // The body follows as the worker produces it; see pump_stream.
+            conn.stream = response.stream;
+            conn.stream_keep_alive = keep_alive;
             return;
         }
 
-        buffer[bytes_read] = '\0';
-        std::string request(buffer);
+        if (!response.body->empty()) {
+            push_output(conn, response.body);
+        }
+        if (!keep_alive) {
+            conn.closing = true;
+        }
+    }
+
+    static void push_output(Connection& conn, Body data) {
+        conn.queued += data->size();
+        conn.out.push_back(Chunk{std::move(data), 0});
+    }
+
+    // Sends as much queued output as the socket takes. Returns false once
+    // the connection should be closed.
+    bool flush(int fd, Connection& conn) {
+        while (true) {
+            if (conn.out.empty()) {
+                if (!conn.next_event) {
+                    break;
+                }
+                push_output(conn, std::move(conn.next_event));
+                conn.next_event.reset();
+            }
+
+            struct iovec iov[16];
+            int count = 0;
+            for (auto it = conn.out.begin(); it != conn.out.end() && count < 16; ++it, ++count) {
+                iov[count].iov_base = const_cast<char*>(it->data->data() + it->offset);
+                iov[count].iov_len = it->data->size() - it->offset;
+            }
+
+            struct msghdr message{};
+            message.msg_iov = iov;
+            message.msg_iovlen = count;
+            ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+            if (sent < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                return false;
+            }
+
+            size_t remaining = static_cast<size_t>(sent);
+            conn.queued -= remaining;
+            while (remaining > 0) {
+                Chunk& chunk = conn.out.front();
+                size_t left = chunk.data->size() - chunk.offset;
+                if (remaining < left) {
+                    chunk.offset += remaining;
+                    break;
+                }
+                remaining -= left;
+                conn.out.pop_front();
+            }
+        }
+
+        if (conn.out.empty() && !conn.busy && (conn.closing || conn.read_closed)) {
+            return false;
+        }
+        if (conn.subscription && conn.read_closed) {
+            return false;
+        }
+
+        // Stop watching for input the client will not send, and for
+        // writability once there is nothing left to write.
+        uint32_t events = 0;
+        if (!conn.read_closed && !conn.closing) {
+            events |= EPOLLIN | EPOLLRDHUP;
+        }
+        if (!conn.out.empty()) {
+            events |= EPOLLOUT;
+        }
+        if (events != conn.events) {
+            conn.events = events;
+            return watch(fd, events, EPOLL_CTL_MOD);
+        }
+        return true;
+    }
 
-        std::string method, path;
-        parse_request_line(request, method, path);
+    void close_connection(int fd) {
+        auto it = connections_.find(fd);
+        if (it != connections_.end() && it->second.stream) {
+            cancel_stream(*it->second.stream);
+        }
+        if (it != connections_.end() && it->second.subscription) {
+            subscribers_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        connections_.erase(fd);
+    }
 
-        if (method == "GET") {
-            handle_get(client_fd, path);
-        } else {
-            send_response(client_fd, 405, "Method Not Allowed", "text/plain");
+    void close_idle_connections(std::chrono::steady_clock::time_point now) {
+        std::vector<int> idle;
+        for (const auto& entry : connections_) {
+            // A stream stalled by a client that stopped reading counts as
+            // idle too, which frees its worker.
+            if ((!entry.second.busy || entry.second.stream) && !entry.second.subscription &&
+                now - entry.second.last_active >= IDLE_TIMEOUT) {
+                idle.push_back(entry.first);
+            }
+        }
+        for (int fd : idle) {
+            close_connection(fd);
         }
     }
 
-    void parse_request_line(const std::string& request, std::string& method, std::string& path) {
-        size_t first_space = request.find(' ');
-        size_t second_space = request.find(' ', first_space + 1);
-        
+    static void parse_request_line(const std::string& head, std::string& method, std::string& path,
+                                   std::string& version) {
+        size_t line_end = head.find("\r\n");
+        std::string line = head.substr(0, line_end);
+        size_t first_space = line.find(' ');
+        size_t second_space = line.find(' ', first_space + 1);
+
         if (first_space != std::string::npos && second_space != std::string::npos) {
-            method = request.substr(0, first_space);
-            path = request.substr(first_space + 1, second_space - first_space - 1);
+            method = line.substr(0, first_space);
+            path = line.substr(first_space + 1, second_space - first_space - 1);
+            version = line.substr(second_space + 1);
         }
     }
 
-    void handle_get(int client_fd, const std::string& path) {
-        if (path == "/" || path == "/metrics") {
-            std::string json = storage_.get_latest_json(1);
-            send_response(client_fd, 200, json, "application/json");
-        } else if (path.find("/metrics/latest") == 0) {
+    // Value of a header, matched case-insensitively; empty if absent.
+    static std::string get_header(const std::string& head, const std::string& name) {
+        size_t pos = head.find("\r\n");
+        while (pos != std::string::npos && pos + 2 < head.size()) {
+            size_t start = pos + 2;
+            size_t end = head.find("\r\n", start);
+            if (end == std::string::npos) {
+                end = head.size();
+            }
+
+            size_t colon = head.find(':', start);
+            if (colon != std::string::npos && colon < end && colon - start == name.size() &&
+                std::equal(name.begin(), name.end(), head.begin() + start,
+                           [](char a, char b) { return std::tolower(a) == std::tolower(b); })) {
+                size_t value = head.find_first_not_of(" \t", colon + 1);
+                size_t value_end = head.find_last_not_of(" \t", end - 1);
+                return value < end && value_end >= value ? head.substr(value, value_end - value + 1) : "";
+            }
+            pos = end;
+        }
+        return "";
+    }
+
+    static Response make_response(int status, std::string body, const std::string& content_type) {
+        Response response;
+        response.status = status;
+        response.content_type = content_type;
+        response.body = std::make_shared<const std::string>(std::move(body));
+        return response;
+    }
+
+    // The body of a buffer published once per sample, shared with every
+    // request for it until the next sample. Its version is the ETag, so a
+    // client that already holds it gets 304 without a body, and it may be
+    // reused until the next sample is due. Has no body if nothing was
+    // published yet.
+    Response cached_response(const CachedBuffer& buffer, const std::string& content_type,
+                             const std::string& head) {
+        static const Body empty = std::make_shared<const std::string>();
+
+        Response response;
+        uint64_t generation = 0;
+        Body body = buffer.get(generation);
+        if (!body) {
+            return response;
+        }
+
+        // Each encoding is a separate variant with its own entity tag.
+        std::string variant;
+        if (body->size() >= http::MIN_COMPRESS_SIZE && accepts_gzip(head)) {
+            body = buffer.getCompressed(gzip_level_, generation);
+            response.content_encoding = "gzip";
+            variant = "-gzip";
+        }
+
+        auto age = std::chrono::steady_clock::now() -
+                   std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(published_at_.load()));
+        long long remaining = interval_seconds_ - std::chrono::duration_cast<std::chrono::seconds>(age).count();
+        response.max_age = static_cast<int>(std::max(0LL, std::min<long long>(remaining, interval_seconds_)));
+        response.etag = "\"" + etag_prefix_ + std::to_string(generation) + variant + "\"";
+
+        std::string if_none_match = get_header(head, "if-none-match");
+        if (if_none_match == "*" || (!if_none_match.empty() && if_none_match.find(response.etag) != std::string::npos)) {
+            response.status = 304;
+            response.body = empty;
+            response.content_encoding.clear();
+            response.vary = gzip_level_ > 0;
+            return response;
+        }
+
+        response.content_type = content_type;
+        response.body = body;
+        return response;
+    }
+
+    // A JSON response whose body a worker writes as it is sent.
+    static Response make_stream(Producer producer) {
+        Response response;
+        response.content_type = "application/json";
+        response.producer = std::move(producer);
+        return response;
+    }
+
+    Response dispatch(const std::string& path, const std::string& head) {
+        try {
+            Response response = handle_get(path, head);
+            encode(response, head);
+            return response;
+        } catch (...) {
+            return make_response(400, "Bad Request", "text/plain");
+        }
+    }
+
+    bool accepts_gzip(const std::string& head) const {
+        return gzip_level_ > 0 && http::acceptsGzip(get_header(head, "accept-encoding"));
+    }
+
+    // Compresses a JSON or text body for a client that accepts gzip. Small
+    // bodies are left alone; streams are compressed as they are produced.
+    void encode(Response& response, const std::string& head) {
+        bool compressible = response.status == 200 && gzip_level_ > 0 &&
+                            (response.content_type.rfind("application/json", 0) == 0 ||
+                             response.content_type.rfind("text/plain", 0) == 0);
+        if (!compressible) {
+            return;
+        }
+
+        response.vary = true;
+        if (!response.content_encoding.empty() || !accepts_gzip(head)) {
+            return;
+        }
+        if (response.producer) {
+            response.content_encoding = "gzip";
+        } else if (response.body->size() >= http::MIN_COMPRESS_SIZE) {
+            response.body = std::make_shared<const std::string>(http::gzipCompress(*response.body, gzip_level_));
+            response.content_encoding = "gzip";
+        }
+    }
+
+    // Sample endpoints (/metrics, /metrics/latest, /metrics/range) accept a
+    // projection: fields=cpu.usage,disks[*].usage keeps only those fields,
+    // and label filters such as mount=/data keep only matching entries.
+    Response handle_get(const std::string& path, const std::string& head) {
+        std::string route = path.substr(0, path.find('?'));
+        auto projection = metrics::schema::parseProjection(path);
+        const metrics::schema::Projection* selected = projection.selectsAll() ? nullptr : &projection;
+
+        if (route == "/" || route == "/metrics") {
+            if (path == route) {
+                Response response = cached_response(latest_, "application/json", head);
+                if (response.body) {
+                    return response;
+                }
+            }
+            return make_response(200, storage_.get_latest_json(1, selected), "application/json");
+        } else if (route == "/metrics/prometheus") {
+            Response response = cached_response(prometheus_, "text/plain; version=0.0.4; charset=utf-8", head);
+            if (response.body) {
+                return response;
+            }
+            return make_response(503, "No sample collected yet", "text/plain");
+        } else if (route == "/metrics/latest") {
             size_t count = 100;
-            size_t pos = path.find("?count=");
-            if (pos != std::string::npos) {
-                count = std::stoi(path.substr(pos + 7));
-            }
-            std::string json = storage_.get_latest_json(count);
-            send_response(client_fd, 200, json, "application/json");
-        } else if (path == "/health") {
-            send_response(client_fd, 200, "{\"status\":\"ok\"}", "application/json");
-        } else if (path == "/stats") {
+            std::string value = get_query_param(path, "count");
+            if (!value.empty() && !parse_count(value, count)) {
+                return make_response(400, "Invalid count", "text/plain");
+            }
+            return make_stream([this, count, projection](const LocalStorage::JsonSink& sink) {
+                return storage_.stream_latest_json(count, projection.selectsAll() ? nullptr : &projection, sink);
+            });
+        } else if (route == "/metrics/now") {
+            return handle_now(projection);
+        } else if (path.find("/metrics/series") == 0) {
+            return handle_series(path);
+        } else if (path.find("/metrics/range") == 0) {
+            return handle_range(path, projection);
+        } else if (route == "/health") {
+            return make_response(200, "{\"status\":\"ok\"}", "application/json");
+        } else if (route == "/stats") {
+            StorageStats stats = storage_.get_stats();
             std::ostringstream oss;
             oss << "{"
-                << "\"total_metrics\":" << storage_.get_total_metrics_count() << ","
-                << "\"storage_path\":\"" << storage_.get_storage_path() << "\""
+                << "\"total_metrics\":" << stats.total_records << ","
+                << "\"storage_path\":\"" << storage_.get_storage_path() << "\","
+                << "\"segments\":" << stats.segments << ","
+                << "\"total_bytes\":" << stats.total_bytes << ","
+                << "\"first_timestamp\":" << stats.first_ts << ","
+                << "\"last_timestamp\":" << stats.last_ts << ","
+                << "\"writer\":{"
+                << "\"queue_depth\":" << stats.queue_depth << ","
+                << "\"records_written\":" << stats.records_written << ","
+                << "\"dropped\":" << stats.dropped << ","
+                << "\"commits\":" << stats.commits << ","
+                << "\"syncs\":" << stats.syncs << ","
+                << "\"write_latency_us\":{"
+                << "\"last\":" << stats.last_write_us << ","
+                << "\"avg\":" << stats.avg_write_us << ","
+                << "\"max\":" << stats.max_write_us
+                << "}}"
                 << "}";
-            send_response(client_fd, 200, oss.str(), "application/json");
-        } else {
-            send_response(client_fd, 404, "Not Found", "text/plain");
+            return make_response(200, oss.str(), "application/json");
+        }
+        return make_response(404, "Not Found", "text/plain");
+    }
+
+    // GET /metrics/now: a sample collected for this request, or by one made
+    // at most a moment earlier, rather than the last scheduled one. Only the
+    // fast monitors are re-read; see CollectTrigger and collectFast(). The
+    // query selects fields as for /metrics.
+    Response handle_now(const metrics::schema::Projection& projection) {
+        auto sample = collect_now_ ? collect_now_() : nullptr;
+        if (!sample) {
+            return make_response(503, "Collection unavailable", "text/plain");
+        }
+
+        std::string json;
+        json.reserve(4096);
+        if (!metrics::schema::writeProjectedJSON(json, *sample, projection)) {
+            return make_response(404, "No matching sample", "text/plain");
+        }
+        return make_response(200, std::move(json), "application/json");
+    }
+
+    // GET /metrics/series?name=<path>[&start=<ts>][&end=<ts>][&step=<s>][&agg=avg|min|max|last]:
+    // one series over a time range, one point list per label set. The range
+    // defaults to the last hour. A step selects the coarsest rollup tier not
+    // wider than it.
+    Response handle_series(const std::string& path) {
+        std::string name = get_query_param(path, "name");
+        if (name.empty()) {
+            return make_response(400, "Missing name parameter", "text/plain");
+        }
+
+        time_t start, end;
+        uint64_t step;
+        if (!parse_time_range(path, start, end, step)) {
+            return make_response(400, "Invalid time range", "text/plain");
+        }
+
+        Aggregation aggregation = parse_aggregation(get_query_param(path, "agg"));
+        auto series = storage_.get_series(name, start, end, step, aggregation);
+
+        std::string json = "{\"name\":\"";
+        metrics::schema::appendEscaped(json, name);
+        json += "\",\"resolution\":";
+        metrics::schema::appendInteger(json, storage_.resolution_for(step));
+        json += ",\"series\":[";
+        bool first_series = true;
+        for (const auto& entry : series) {
+            if (!first_series) json += ",";
+            first_series = false;
+
+            json += "{\"labels\":{";
+            json += entry.first;
+            json += "},\"points\":[";
+            for (size_t i = 0; i < entry.second.size(); ++i) {
+                if (i > 0) json += ",";
+                json += "[";
+                metrics::schema::appendInteger(json, entry.second[i].timestamp);
+                json += ",";
+                metrics::schema::appendFixed(json, entry.second[i].value);
+                json += "]";
+            }
+            json += "]}";
         }
+        json += "]}";
+
+        return make_response(200, std::move(json), "application/json");
     }
 
-    void send_response(int client_fd, int status_code, const std::string& body, const std::string& content_type) {
-        std::ostringstream response;
-        response << "HTTP/1.1 " << status_code << " " << get_status_text(status_code) << "\r\n";
-        response << "Content-Type: " << content_type << "\r\n";
-        response << "Content-Length: " << body.length() << "\r\n";
-        response << "Access-Control-Allow-Origin: *\r\n";
-        response << "Connection: close\r\n";
-        response << "\r\n";
-        response << body;
+    // GET /metrics/range[?start=<ts>][&end=<ts>][&step=<s>]: the stored
+    // samples of a time range, by default the last hour. With a step, one
+    // sample per step seconds: the last one of each interval.
+    Response handle_range(const std::string& path, const metrics::schema::Projection& projection) {
+        time_t start, end;
+        uint64_t step;
+        if (!parse_time_range(path, start, end, step)) {
+            return make_response(400, "Invalid time range", "text/plain");
+        }
+
+        return make_stream([this, start, end, step, projection](const LocalStorage::JsonSink& sink) {
+            return storage_.stream_range_json(start, end, step, projection.selectsAll() ? nullptr : &projection,
+                                              sink);
+        });
+    }
 
-        std::string response_str = response.str();
-        send(client_fd, response_str.c_str(), response_str.length(), 0);
+    // Reads start, end and step. The range defaults to the hour up to end,
+    // which defaults to now.
+    static bool parse_time_range(const std::string& path, time_t& start, time_t& end, uint64_t& step) {
+        end = std::time(nullptr);
+        step = 0;
+        try {
+            std::string value = get_query_param(path, "end");
+            if (!value.empty()) end = std::stoll(value);
+            value = get_query_param(path, "start");
+            start = value.empty() ? end - 3600 : std::stoll(value);
+            value = get_query_param(path, "step");
+            if (!value.empty()) step = std::stoull(value);
+        } catch (...) {
+            return false;
+        }
+        return start <= end;
+    }
+
+    // Accepts a positive decimal count and caps it at MAX_LATEST_COUNT.
+    static bool parse_count(const std::string& value, size_t& count) {
+        if (value.size() > 19 || value.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        uint64_t parsed = std::stoull(value);
+        if (parsed == 0) {
+            return false;
+        }
+        count = std::min<uint64_t>(parsed, MAX_LATEST_COUNT);
+        return true;
+    }
+
+    static std::string get_query_param(const std::string& path, const std::string& name) {
+        size_t query = path.find('?');
+        if (query == std::string::npos) {
+            return "";
+        }
+
+        size_t pos = query + 1;
+        while (pos < path.size()) {
+            size_t end = path.find('&', pos);
+            if (end == std::string::npos) {
+                end = path.size();
+            }
+
+            size_t eq = path.find('=', pos);
+            if (eq != std::string::npos && eq < end && path.compare(pos, eq - pos, name) == 0 &&
+                eq - pos == name.size()) {
+                return path.substr(eq + 1, end - eq - 1);
+            }
+            pos = end + 1;
+        }
+        return "";
     }
 
-    std::string get_status_text(int status_code) {
+    static std::string get_status_text(int status_code) {
         switch (status_code) {
             case 200: return "OK";
+            case 304: return "Not Modified";
+            case 400: return "Bad Request";
+            case 403: return "Forbidden";
             case 404: return "Not Found";
             case 405: return "Method Not Allowed";
             case 500: return "Internal Server Error";
+            case 503: return "Service Unavailable";
             default: return "Unknown";
         }
     }
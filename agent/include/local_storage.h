@@ -1,65 +1,242 @@
 #pragma once
 
 #include "metrics.h"
+#include "metrics_schema.h"
+#include "segment.h"
+#include "columnar.h"
+#include "rollup.h"
+#include "spsc_queue.h"
+#include "sample_ring.h"
 #include <string>
 #include <vector>
-#include <fstream>
+#include <map>
 #include <filesystem>
 #include <chrono>
 #include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <sstream>
 
 namespace blinky {
 namespace agent {
 
+enum class SyncPolicy {
+    NONE,       // Leave flushing to the kernel
+    INTERVAL,   // fdatasync at most once per interval
+    EVERY       // fdatasync after every N records
+};
+
+struct SyncOptions {
+    SyncPolicy policy = SyncPolicy::NONE;
+    std::chrono::milliseconds interval{1000};
+    size_t every = 1;
+};
+
+inline SyncPolicy parse_sync_policy(const std::string& value) {
+    if (value == "interval") return SyncPolicy::INTERVAL;
+    if (value == "every") return SyncPolicy::EVERY;
+    return SyncPolicy::NONE;
+}
+
+struct RollupOptions {
+    uint64_t width_seconds;
+    uint64_t retention_seconds;
+};
+
+// One-minute buckets kept for two weeks, one-hour buckets for 400 days.
+inline std::vector<RollupOptions> default_rollups() {
+    return {{60, 14 * 86400}, {3600, 400 * 86400}};
+}
+
+struct StorageStats {
+    size_t queue_depth = 0;
+    uint64_t records_written = 0;
+    uint64_t dropped = 0;
+    uint64_t commits = 0;
+    uint64_t syncs = 0;
+    uint64_t last_write_us = 0;
+    uint64_t max_write_us = 0;
+    uint64_t avg_write_us = 0;
+
+    // From the manifest; includes the active segment and column files.
+    size_t segments = 0;
+    uint64_t total_records = 0;
+    uint64_t total_bytes = 0;
+    uint64_t first_ts = 0;
+    uint64_t last_ts = 0;
+};
+
+// Stores samples in append-only segment files (see segment.h). The active
+// segment stays open for appending and is sealed with its block index when
+// it reaches max_file_size_mb or the local day changes, so range queries
+// over sealed segments only read the blocks they need. Sealed segments are
+// then rewritten with each block compressed; readers decompress only the
+// blocks a query touches. Each sealed segment also gets a column file (see
+// columnar.h) that answers single-series queries. Old segments are
+// removed once there are more than max_files of them or together they
+// exceed max_total_size_mb.
+//
+// A manifest of the sealed segments (file, record count, size, time range)
+// is kept in memory and in the MANIFEST file, updated on rotation, on
+// compression and on cleanup. Stats, retention and the choice of segments
+// for a query come from it instead of listing and reading the directory.
+//
+// store() only encodes the sample and hands it to a writer thread through a
+// lock-free queue, so it must be called from a single thread. The writer
+// appends everything queued with one write() and syncs according to the
+// SyncOptions. It also folds every sample into the rollup tiers (see
+// rollup.h), which keep downsampled history for longer than raw samples.
+//
+// The last cache_samples samples are also kept in memory as serialized JSON
+// (see sample_ring.h); reads of recent samples only go to disk when they ask
+// for more than that.
 class LocalStorage {
 public:
+    // Receives a JSON body in pieces, in order. Returning false stops the
+    // read that produces them.
+    using JsonSink = std::function<bool(std::string&& piece)>;
+
+    static constexpr size_t STREAM_CHUNK_SIZE = 64 * 1024;
+
     LocalStorage(const std::string& storage_path = "/var/lib/blinky/metrics",
                  size_t max_files = 100,
-                 size_t max_file_size_mb = 10)
+                 size_t max_file_size_mb = 10,
+                 size_t max_total_size_mb = 1024,
+                 SyncOptions sync = SyncOptions(),
+                 std::vector<RollupOptions> rollups = default_rollups(),
+                 size_t cache_samples = 300)
         : storage_path_(storage_path)
-        , max_files_(max_files)
+        , max_files_(max_files > 0 ? max_files : 1)
         , max_file_size_bytes_(max_file_size_mb * 1024 * 1024)
-        , current_file_size_(0) {
-        
+        , max_total_size_bytes_(max_total_size_mb * 1024 * 1024)
+        , sync_(sync)
+        , recent_(cache_samples)
+        , queue_(QUEUE_CAPACITY) {
+
+        if (sync_.every == 0) {
+            sync_.every = 1;
+        }
+
         initialize_storage();
+
+        read_latest(recent_.capacity(), [this](std::string_view payload) {
+            recent_.push(std::make_shared<const std::string>(payload));
+        });
+
+        std::sort(rollups.begin(), rollups.end(),
+                  [](const RollupOptions& a, const RollupOptions& b) { return a.width_seconds < b.width_seconds; });
+        for (const auto& tier : rollups) {
+            if (tier.width_seconds > 0 && tier.retention_seconds > 0) {
+                tiers_.push_back(std::make_unique<RollupTier>(
+                    storage_path_ + "/rollup-" + std::to_string(tier.width_seconds) + "s",
+                    tier.width_seconds, tier.retention_seconds));
+            }
+        }
+
+        writer_ = std::thread(&LocalStorage::writer_loop, this);
     }
 
+    // Writes out everything still queued before closing the active segment.
+    ~LocalStorage() {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        writer_.join();
+
+        if (fd_ >= 0) {
+            if (sync_.policy != SyncPolicy::NONE) {
+                fdatasync(fd_);
+            }
+            close(fd_);
+        }
+    }
+
+    LocalStorage(const LocalStorage&) = delete;
+    LocalStorage& operator=(const LocalStorage&) = delete;
+
+    // Queues a sample for the writer thread. Returns false if the queue is
+    // full, in which case the sample is dropped.
     bool store(const metrics::SystemMetrics& metrics) {
         try {
-            if (should_rotate()) {
-                rotate_files();
-            }
+            auto json = std::make_shared<const std::string>(metrics.toJSON());
+            recent_.push(json);
 
-            std::string json = metrics.toJSON();
-            std::string line = json + "\n";
+            PendingRecord pending;
+            pending.timestamp = metrics.timestamp;
+            segment::encode_record(pending.record, metrics.timestamp, *json);
+            if (!tiers_.empty()) {
+                pending.sample = metrics;
+            }
 
-            std::ofstream file(get_current_file_path(), std::ios::app);
-            if (!file.is_open()) {
+            if (!queue_.push(std::move(pending))) {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
                 return false;
             }
 
-            file << line;
-            current_file_size_ += line.size();
-            file.close();
-
+            queued_.fetch_add(1, std::memory_order_release);
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex_);
+            }
+            wake_.notify_one();
             return true;
         } catch (...) {
             return false;
         }
     }
 
+    // Blocks until every sample queued so far has been written.
+    void flush() {
+        uint64_t target = queued_.load(std::memory_order_acquire);
+        std::unique_lock<std::mutex> lock(wake_mutex_);
+        wake_.notify_one();
+        idle_.wait(lock, [this, target] { return committed_ >= target || stopping_; });
+    }
+
+    StorageStats get_stats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        StorageStats stats = stats_;
+        stats.queue_depth = queue_.size();
+        stats.dropped = dropped_.load(std::memory_order_relaxed);
+        stats.avg_write_us = stats_.commits > 0 ? total_write_us_ / stats_.commits : 0;
+
+        stats.segments = manifest_.size();
+        stats.total_records = manifest_records_;
+        stats.total_bytes = manifest_bytes_;
+        if (!manifest_.empty()) {
+            stats.first_ts = manifest_.front().first_ts;
+            stats.last_ts = manifest_.back().last_ts;
+        }
+        if (fd_ >= 0) {
+            stats.segments += 1;
+            stats.total_records += active_.record_count;
+            stats.total_bytes += active_.data_end;
+            if (active_.record_count > 0) {
+                stats.first_ts = stats.first_ts > 0 ? stats.first_ts : active_.first_ts;
+                stats.last_ts = active_.last_ts;
+            }
+        }
+        return stats;
+    }
+
+    // Returns up to count of the most recent samples, oldest first.
     std::vector<metrics::SystemMetrics> get_latest(size_t count = 100) {
         std::vector<metrics::SystemMetrics> result;
-        
-        try {
-            auto files = get_metric_files();
-            
-            for (auto it = files.rbegin(); it != files.rend() && result.size() < count; ++it) {
-                auto metrics = read_file(*it, count - result.size());
-                result.insert(result.end(), metrics.begin(), metrics.end());
+
+        for (const auto& payload : latest_payloads(count)) {
+            try {
+                result.push_back(metrics::SystemMetrics::fromJSON(*payload));
+            } catch (...) {
+                // Skip unreadable records
             }
-        } catch (...) {
-            // Return empty vector on error
         }
 
         return result;
@@ -67,71 +244,221 @@ public:
 
     std::vector<metrics::SystemMetrics> get_range(time_t start_time, time_t end_time) {
         std::vector<metrics::SystemMetrics> result;
-        
+
+        if (end_time < start_time || end_time < 0) {
+            return result;
+        }
+
+        uint64_t start = static_cast<uint64_t>(std::max<time_t>(start_time, 0));
+        uint64_t end = static_cast<uint64_t>(end_time);
+
         try {
-            auto files = get_metric_files();
-            
-            for (const auto& file : files) {
-                auto metrics = read_file(file, 0);
-                for (const auto& m : metrics) {
-                    if (m.timestamp >= start_time && m.timestamp <= end_time) {
-                        result.push_back(m);
-                    }
-                }
+            for (const auto& info : get_segments(start, end)) {
+                segment::read_range(info, start, end,
+                    [&result](uint64_t, std::string_view payload) {
+                        try {
+                            result.push_back(metrics::SystemMetrics::fromJSON(payload));
+                        } catch (...) {
+                            // Skip unreadable records
+                        }
+                    });
             }
         } catch (...) {
-            // Return empty vector on error
+            // Return partial results on error
         }
 
         return result;
     }
 
-    std::string get_latest_json(size_t count = 1) {
-        auto metrics = get_latest(count);
-        if (metrics.empty()) {
-            return "{}";
+    // The samples between start_time and end_time as a JSON array of the
+    // stored records, without parsing them. See stream_range_json.
+    std::string get_range_json(time_t start_time, time_t end_time, uint64_t step = 0,
+                               const metrics::schema::Projection* projection = nullptr) {
+        std::string result;
+        stream_range_json(start_time, end_time, step, projection, collect_into(result), SIZE_MAX);
+        return result;
+    }
+
+    // Writes the samples between start_time and end_time as a JSON array of
+    // the stored records, handing it to sink in pieces of about chunk_size
+    // bytes. Only the blocks of the segments overlapping the range are read.
+    // With a step, the range is cut into step-aligned intervals and only the
+    // last sample of each is kept. A projection is applied to each record as
+    // it is copied. Returns false if the sink stopped the read.
+    bool stream_range_json(time_t start_time, time_t end_time, uint64_t step,
+                           const metrics::schema::Projection* projection, const JsonSink& sink,
+                           size_t chunk_size = STREAM_CHUNK_SIZE) {
+        JsonArrayWriter writer(sink, chunk_size, projection);
+
+        if (end_time < start_time || end_time < 0) {
+            return writer.finish();
         }
-        
-        if (count == 1) {
-            return metrics[0].toJSON();
+
+        uint64_t start = static_cast<uint64_t>(std::max<time_t>(start_time, 0));
+        uint64_t end = static_cast<uint64_t>(end_time);
+
+        std::string held;
+        uint64_t held_interval = 0;
+        bool holding = false;
+
+        try {
+            for (const auto& info : get_segments(start, end)) {
+                if (!writer.ok()) {
+                    break;
+                }
+                segment::read_range(info, start, end, [&](uint64_t timestamp, std::string_view payload) {
+                    if (step == 0) {
+                        writer.add(payload);
+                        return;
+                    }
+
+                    uint64_t interval = timestamp - timestamp % step;
+                    if (holding && interval != held_interval) {
+                        writer.add(held);
+                    }
+                    held.assign(payload);
+                    held_interval = interval;
+                    holding = true;
+                });
+            }
+        } catch (...) {
+            // Return partial results on error
         }
 
-        std::string result = "[";
-        for (size_t i = 0; i < metrics.size(); ++i) {
-            if (i > 0) result += ",";
-            result += metrics[i].toJSON();
+        if (holding) {
+            writer.add(held);
         }
-        result += "]";
-        
-        return result;
+        return writer.finish();
     }
 
-    size_t get_total_metrics_count() {
-        size_t count = 0;
+    // Points of every series with the given dotted path (e.g. "cpu.usage" or
+    // "disks.used") between start_time and end_time, keyed by the labels
+    // that distinguish the series. Sealed segments are answered from their
+    // column files, which hold each series separately.
+    //
+    // With a step of at least a rollup tier's width the coarsest such tier
+    // is read instead, yielding one point per bucket reduced by aggregation.
+    std::map<std::string, std::vector<columnar::Point>> get_series(const std::string& series,
+                                                                   time_t start_time, time_t end_time,
+                                                                   uint64_t step = 0,
+                                                                   Aggregation aggregation = Aggregation::AVG) {
+        std::map<std::string, std::vector<columnar::Point>> result;
+
+        if (end_time < start_time || end_time < 0) {
+            return result;
+        }
+
+        uint64_t start = static_cast<uint64_t>(std::max<time_t>(start_time, 0));
+        uint64_t end = static_cast<uint64_t>(end_time);
+
         try {
-            auto files = get_metric_files();
-            for (const auto& file : files) {
-                std::ifstream f(file);
-                count += std::count(std::istreambuf_iterator<char>(f),
-                                   std::istreambuf_iterator<char>(), '\n');
+            RollupTier* tier = tier_for(step);
+            if (tier) {
+                tier->read_series(series, start, end, aggregation, result);
+                return result;
+            }
+
+            for (const auto& info : get_segments(start, end)) {
+                if (info.record_count == 0 || info.last_ts < start || info.first_ts > end) {
+                    continue;
+                }
+
+                std::map<std::string, std::vector<columnar::Point>> points;
+                if (info.sealed && columnar::read_series(columnar::column_file_path(info.path),
+                                                         series, start, end, points)) {
+                    for (auto& entry : points) {
+                        auto& out = result[entry.first];
+                        out.insert(out.end(), entry.second.begin(), entry.second.end());
+                    }
+                    continue;
+                }
+
+                segment::read_range(info, start, end,
+                    [&](uint64_t timestamp, std::string_view payload) {
+                        try {
+                            auto sample = metrics::SystemMetrics::fromJSON(payload);
+                            metrics::schema::forEachSeries(sample,
+                                [&](const std::string& path, const std::string& labels, double value) {
+                                    if (path == series) {
+                                        result[labels].push_back({timestamp, value});
+                                    }
+                                });
+                        } catch (...) {
+                            // Skip unreadable records
+                        }
+                    });
             }
         } catch (...) {
-            // Return 0 on error
+            // Return partial results on error
         }
-        return count;
+
+        return result;
     }
 
-    void cleanup_old_files() {
-        try {
-            auto files = get_metric_files();
-            
-            while (files.size() > max_files_) {
-                std::filesystem::remove(files.front());
-                files.erase(files.begin());
+    // Width in seconds of the data get_series returns for a step: the
+    // coarsest rollup tier not wider than the step, or 0 for raw samples.
+    uint64_t resolution_for(uint64_t step) {
+        RollupTier* tier = tier_for(step);
+        return tier ? tier->width() : 0;
+    }
+
+    // Records are stored as JSON, so they are returned as-is rather than
+    // being parsed and serialized again. A single sample is returned as an
+    // object, more as an array (see stream_latest_json).
+    std::string get_latest_json(size_t count = 1, const metrics::schema::Projection* projection = nullptr) {
+        if (count != 1) {
+            std::string result;
+            stream_latest_json(count, projection, collect_into(result), SIZE_MAX);
+            return result;
+        }
+
+        auto payloads = latest_payloads(1);
+        if (payloads.empty()) {
+            return "{}";
+        }
+        if (!projection) {
+            return *payloads.back();
+        }
+
+        std::string result;
+        return metrics::schema::projectJSON(*payloads.back(), result, *projection) ? result : "{}";
+    }
+
+    // Writes up to count of the most recent samples, oldest first, as a JSON
+    // array, handing it to sink in pieces of about chunk_size bytes. The
+    // samples are copied from the in-memory ring when it holds enough, and
+    // otherwise read block by block from the tails of the segments holding
+    // them. Returns false if the sink stopped the read.
+    bool stream_latest_json(size_t count, const metrics::schema::Projection* projection, const JsonSink& sink,
+                            size_t chunk_size = STREAM_CHUNK_SIZE) {
+        JsonArrayWriter writer(sink, chunk_size, projection);
+
+        std::vector<SampleRing::Payload> cached;
+        if (recent_.latest(count, cached)) {
+            for (const auto& payload : cached) {
+                if (!writer.add(*payload)) {
+                    break;
+                }
             }
-        } catch (...) {
-            // Ignore cleanup errors
+        } else {
+            read_latest(count, [&writer](std::string_view payload) {
+                writer.add(payload);
+            });
         }
+
+        return writer.finish();
+    }
+
+    size_t get_total_metrics_count() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return manifest_records_ + (fd_ >= 0 ? active_.record_count : 0);
+    }
+
+    // Removes the oldest segments until both the file count and the total
+    // size are within limits. The active segment is never removed.
+    void cleanup_old_files() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        remove_old_segments();
     }
 
     std::string get_storage_path() const {
@@ -139,93 +466,887 @@ public:
     }
 
 private:
+    // Appends records to a JSON array and hands the array to a sink
+    // whenever chunk_size bytes are buffered, so a large body is never held
+    // whole. Once the sink refuses, further records are dropped.
+    class JsonArrayWriter {
+    public:
+        JsonArrayWriter(const JsonSink& sink, size_t chunk_size, const metrics::schema::Projection* projection)
+            : sink_(sink)
+            , chunk_size_(chunk_size)
+            , projection_(projection) {
+            reserve();
+            buffer_ += "[";
+        }
+
+        bool ok() const {
+            return ok_;
+        }
+
+        bool add(std::string_view record) {
+            if (!ok_) {
+                return false;
+            }
+
+            size_t mark = buffer_.size();
+            if (!first_) buffer_ += ",";
+            if (!projection_) {
+                buffer_.append(record);
+            } else if (!metrics::schema::projectJSON(record, buffer_, *projection_)) {
+                buffer_.resize(mark);
+                return true;
+            }
+            first_ = false;
+
+            if (buffer_.size() >= chunk_size_) {
+                ok_ = sink_(std::move(buffer_));
+                buffer_.clear();
+                reserve();
+            }
+            return ok_;
+        }
+
+        bool finish() {
+            if (ok_) {
+                buffer_ += "]";
+                ok_ = sink_(std::move(buffer_));
+            }
+            return ok_;
+        }
+
+    private:
+        const JsonSink& sink_;
+        size_t chunk_size_;
+        const metrics::schema::Projection* projection_;
+        std::string buffer_;
+        bool first_ = true;
+        bool ok_ = true;
+
+        void reserve() {
+            if (chunk_size_ != SIZE_MAX) {
+                buffer_.reserve(chunk_size_ + chunk_size_ / 4);
+            }
+        }
+    };
+
+    // A sink that keeps the whole body in result.
+    static JsonSink collect_into(std::string& result) {
+        return [&result](std::string&& piece) {
+            if (result.empty()) {
+                result = std::move(piece);
+            } else {
+                result += piece;
+            }
+            return true;
+        };
+    }
+
     std::string storage_path_;
     size_t max_files_;
     size_t max_file_size_bytes_;
-    size_t current_file_size_;
+    size_t max_total_size_bytes_;
+    SyncOptions sync_;
+
+    // Most recent samples as stored, newest last.
+    SampleRing recent_;
+
+    static constexpr size_t QUEUE_CAPACITY = 1024;
+    static constexpr size_t MAX_COMMIT_RECORDS = 256;
+
+    struct PendingRecord {
+        uint64_t timestamp = 0;
+        std::string record;
+        metrics::SystemMetrics sample;  // only filled when rollups are kept
+    };
+
+    // Rollup tiers, finest first. Fed by the writer thread only.
+    std::vector<std::unique_ptr<RollupTier>> tiers_;
+
+    // How far back raw samples are replayed into the tiers at startup, to
+    // rebuild buckets that were still open when the agent stopped.
+    static constexpr uint64_t MAX_ROLLUP_REPLAY = 86400;
+
+    // Guards the active segment and the stats; the writer thread holds it
+    // while appending so readers see a consistent block index.
+    std::mutex mutex_;
+    segment::SegmentInfo active_;
+    int fd_ = -1;
+    int active_day_ = -1;
+    StorageStats stats_;
+    uint64_t total_write_us_ = 0;
+
+    SpscQueue<PendingRecord> queue_;
+    std::atomic<uint64_t> queued_{0};
+    std::atomic<uint64_t> dropped_{0};
+
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    uint64_t committed_ = 0;
+    bool stopping_ = false;
+    std::thread writer_;
+
+    // Sealed segments waiting for their column file and compression.
+    std::vector<segment::SegmentInfo> to_finish_;
+
+    // One entry per segment other than the active one, oldest first.
+    // Guarded by mutex_; written to MANIFEST by the writer thread when
+    // changed.
+    struct ManifestEntry {
+        uint64_t id = 0;
+        bool compressed = false;
+        uint64_t records = 0;
+        uint64_t first_ts = 0;
+        uint64_t last_ts = 0;
+        uint64_t size = 0;          // segment file
+        uint64_t column_size = 0;   // column file, 0 if there is none
+    };
+
+    static constexpr const char* MANIFEST_MAGIC = "BLKYMAN1";
+
+    std::vector<ManifestEntry> manifest_;
+    uint64_t manifest_records_ = 0;
+    uint64_t manifest_bytes_ = 0;
+    bool manifest_dirty_ = false;
+
+    size_t unsynced_ = 0;
+    std::chrono::steady_clock::time_point last_sync_ = std::chrono::steady_clock::now();
+
+    void writer_loop() {
+        std::vector<PendingRecord> batch;
+        batch.reserve(MAX_COMMIT_RECORDS);
+
+        replay_rollups();
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(wake_mutex_);
+                auto ready = [this] { return stopping_ || !queue_.empty(); };
+                if (sync_.policy == SyncPolicy::INTERVAL && unsynced_ > 0) {
+                    wake_.wait_for(lock, sync_.interval, ready);
+                } else {
+                    wake_.wait(lock, ready);
+                }
+            }
+
+            PendingRecord pending;
+            while (batch.size() < MAX_COMMIT_RECORDS && queue_.pop(pending)) {
+                batch.push_back(std::move(pending));
+            }
+
+            if (!batch.empty()) {
+                commit(batch);
+                for (const auto& item : batch) {
+                    for (auto& tier : tiers_) {
+                        tier->add(item.sample);
+                    }
+                }
+            }
+            maybe_sync(batch.size());
+            finish_sealed();
+            save_manifest();
+
+            bool done;
+            {
+                std::lock_guard<std::mutex> lock(wake_mutex_);
+                committed_ += batch.size();
+                done = stopping_ && queue_.empty();
+            }
+            idle_.notify_all();
+            batch.clear();
+
+            if (done) {
+                break;
+            }
+        }
+    }
+
+    // Appends a group of records with as few write() calls as possible:
+    // one per segment the group lands in.
+    void commit(const std::vector<PendingRecord>& batch) {
+        auto started = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        std::string buffer;
+        std::vector<const PendingRecord*> pending;
+
+        for (const auto& item : batch) {
+            if (should_rotate(buffer.size(), item.record.size())) {
+                append(buffer, pending);
+                rotate_files();
+            }
+
+            if (fd_ < 0 && !open_segment(next_segment_id())) {
+                continue;
+            }
+
+            buffer += item.record;
+            pending.push_back(&item);
+        }
+        append(buffer, pending);
+
+        uint64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - started).count();
+        stats_.commits += 1;
+        stats_.last_write_us = elapsed;
+        stats_.max_write_us = std::max(stats_.max_write_us, elapsed);
+        total_write_us_ += elapsed;
+    }
+
+    void append(std::string& buffer, std::vector<const PendingRecord*>& pending) {
+        if (buffer.empty() || fd_ < 0) {
+            buffer.clear();
+            pending.clear();
+            return;
+        }
+
+        if (segment::write_all(fd_, buffer.data(), buffer.size())) {
+            for (const auto* item : pending) {
+                segment::index_record(active_, active_.data_end, item->timestamp, item->record.size());
+            }
+            stats_.records_written += pending.size();
+            unsynced_ += pending.size();
+        } else if (ftruncate(fd_, active_.data_end) != 0) {
+            // Drop a partially written group so the next append starts on a
+            // record boundary; if that fails, start a new segment.
+            close(fd_);
+            fd_ = -1;
+            add_entry(entry_for(active_, active_.data_end, 0));
+        }
+
+        buffer.clear();
+        pending.clear();
+    }
+
+    RollupTier* tier_for(uint64_t step) {
+        RollupTier* best = nullptr;
+        for (auto& tier : tiers_) {
+            if (tier->width() <= step) {
+                best = tier.get();
+            }
+        }
+        return best;
+    }
+
+    void replay_rollups() {
+        if (tiers_.empty()) {
+            return;
+        }
+
+        uint64_t now = static_cast<uint64_t>(std::time(nullptr));
+        uint64_t from = now;
+        for (auto& tier : tiers_) {
+            uint64_t last = tier->last_bucket();
+            from = std::min(from, last > 0 ? last + tier->width() : 0);
+        }
+        from = std::max(from, now > MAX_ROLLUP_REPLAY ? now - MAX_ROLLUP_REPLAY : 0);
+
+        for (const auto& info : get_segments(from)) {
+            segment::read_range(info, from, UINT64_MAX, [this](uint64_t, std::string_view payload) {
+                try {
+                    auto sample = metrics::SystemMetrics::fromJSON(payload);
+                    for (auto& tier : tiers_) {
+                        tier->add(sample);
+                    }
+                } catch (...) {
+                    // Skip unreadable records
+                }
+            });
+        }
+    }
+
+    // Writes the column file of each newly sealed segment and compresses
+    // it. Runs without the storage mutex so readers are not held up while a
+    // whole segment is processed.
+    void finish_sealed() {
+        bool sync = sync_.policy != SyncPolicy::NONE;
+        for (const auto& info : to_finish_) {
+            std::string column_path = columnar::column_file_path(info.path);
+            if (!std::filesystem::exists(column_path)) {
+                write_columns(info, column_path, sync);
+            }
+            bool compressed = info.compressed;
+            if (!compressed) {
+                segment::SegmentInfo result;
+                compressed = segment::compress_segment(info, sync, result);
+            }
+
+            std::error_code ec;
+            uint64_t size = std::filesystem::file_size(info.path, ec);
+            if (ec) {
+                continue;
+            }
+            uint64_t column_size = std::filesystem::file_size(column_path, ec);
+            if (ec) {
+                column_size = 0;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            ManifestEntry* entry = find_entry(info.id);
+            if (entry) {
+                manifest_bytes_ -= entry->size + entry->column_size;
+                entry->compressed = compressed;
+                entry->size = size;
+                entry->column_size = column_size;
+                manifest_bytes_ += size + column_size;
+                manifest_dirty_ = true;
+            }
+        }
+        to_finish_.clear();
+    }
+
+    ManifestEntry* find_entry(uint64_t id) {
+        auto it = std::lower_bound(manifest_.begin(), manifest_.end(), id,
+                                   [](const ManifestEntry& entry, uint64_t value) { return entry.id < value; });
+        return it != manifest_.end() && it->id == id ? &*it : nullptr;
+    }
+
+    void add_entry(const ManifestEntry& entry) {
+        manifest_.push_back(entry);
+        manifest_records_ += entry.records;
+        manifest_bytes_ += entry.size + entry.column_size;
+        manifest_dirty_ = true;
+    }
+
+    static ManifestEntry entry_for(const segment::SegmentInfo& info, uint64_t size, uint64_t column_size) {
+        ManifestEntry entry;
+        entry.id = info.id;
+        entry.compressed = info.compressed;
+        entry.records = info.record_count;
+        entry.first_ts = info.first_ts;
+        entry.last_ts = info.last_ts;
+        entry.size = size;
+        entry.column_size = column_size;
+        return entry;
+    }
+
+    std::string segment_path(uint64_t id) const {
+        return storage_path_ + "/" + segment::segment_file_name(id);
+    }
+
+    // Writes the manifest if it changed since the last call, replacing the
+    // previous one atomically. One line per segment:
+    //   <id> <compressed> <records> <first_ts> <last_ts> <size> <column_size>
+    void save_manifest() {
+        std::string data = MANIFEST_MAGIC;
+        data += "\n";
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!manifest_dirty_) {
+                return;
+            }
+            manifest_dirty_ = false;
+
+            for (const auto& entry : manifest_) {
+                data += std::to_string(entry.id) + " " + (entry.compressed ? "1" : "0") + " " +
+                        std::to_string(entry.records) + " " + std::to_string(entry.first_ts) + " " +
+                        std::to_string(entry.last_ts) + " " + std::to_string(entry.size) + " " +
+                        std::to_string(entry.column_size) + "\n";
+            }
+        }
+
+        std::string path = storage_path_ + "/MANIFEST";
+        std::string tmp_path = path + ".tmp";
+        int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return;
+        }
+
+        bool ok = segment::write_all(fd, data.data(), data.size()) &&
+                  (sync_.policy == SyncPolicy::NONE || fdatasync(fd) == 0);
+        close(fd);
+
+        if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            std::remove(tmp_path.c_str());
+        }
+    }
+
+    std::map<uint64_t, ManifestEntry> load_manifest() const {
+        std::map<uint64_t, ManifestEntry> entries;
+        std::ifstream file(storage_path_ + "/MANIFEST");
+        std::string line;
+        if (!std::getline(file, line) || line != MANIFEST_MAGIC) {
+            return entries;
+        }
+
+        while (std::getline(file, line)) {
+            std::istringstream fields(line);
+            ManifestEntry entry;
+            int compressed = 0;
+            if (fields >> entry.id >> compressed >> entry.records >> entry.first_ts >>
+                          entry.last_ts >> entry.size >> entry.column_size) {
+                entry.compressed = compressed != 0;
+                entries[entry.id] = entry;
+            }
+        }
+        return entries;
+    }
+
+    static bool write_columns(const segment::SegmentInfo& info, const std::string& column_path, bool sync) {
+        columnar::ColumnBuilder builder;
+        std::map<std::pair<std::string, std::string>, double> values;
+
+        segment::read_range(info, 0, UINT64_MAX, [&](uint64_t timestamp, std::string_view payload) {
+            values.clear();
+            try {
+                auto sample = metrics::SystemMetrics::fromJSON(payload);
+                metrics::schema::forEachSeries(sample,
+                    [&values](const std::string& path, const std::string& labels, double value) {
+                        values[{path, labels}] = value;
+                    });
+            } catch (...) {
+                // An unreadable record still gets a point in every column
+            }
+            builder.add(timestamp, values);
+        });
+
+        if (builder.size() == 0) {
+            return false;
+        }
+
+        std::string data = builder.finish();
+        std::string tmp_path = column_path + ".tmp";
+        int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+
+        bool ok = segment::write_all(fd, data.data(), data.size()) && (!sync || fdatasync(fd) == 0);
+        close(fd);
+
+        if (!ok || std::rename(tmp_path.c_str(), column_path.c_str()) != 0) {
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void maybe_sync(size_t written) {
+        if (sync_.policy == SyncPolicy::NONE || unsynced_ == 0) {
+            return;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        bool due = sync_.policy == SyncPolicy::EVERY
+            ? unsynced_ >= sync_.every
+            : (written == 0 || now - last_sync_ >= sync_.interval);
+
+        if (!due || fd_ < 0) {
+            return;
+        }
+
+        fdatasync(fd_);
+        unsynced_ = 0;
+        last_sync_ = now;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.syncs += 1;
+    }
 
     void initialize_storage() {
         try {
             std::filesystem::create_directories(storage_path_);
-            
-            auto current_file = get_current_file_path();
-            if (std::filesystem::exists(current_file)) {
-                current_file_size_ = std::filesystem::file_size(current_file);
+
+            // Drop partially written copies left by a restart.
+            for (const auto& entry : std::filesystem::directory_iterator(storage_path_)) {
+                std::string name = entry.path().filename().string();
+                if ((name.rfind("segment-", 0) == 0 || name.rfind("import-", 0) == 0 ||
+                     name.rfind("MANIFEST", 0) == 0) && name.size() > 4 &&
+                    name.compare(name.size() - 4, 4, ".tmp") == 0) {
+                    std::filesystem::remove(entry.path());
+                }
+            }
+
+            import_legacy_files();
+
+            // Rebuild the manifest from the saved one, reading the footer of
+            // a segment only when its files differ from what was recorded.
+            // Sealed segments still missing their column file or
+            // compression are processed again.
+            auto saved = load_manifest();
+            auto files = get_metric_files();
+            for (size_t i = 0; i < files.size(); ++i) {
+                uint64_t id = segment::parse_segment_id(std::filesystem::path(files[i]).filename().string());
+                std::error_code ec;
+                uint64_t size = std::filesystem::file_size(files[i], ec);
+                if (ec) {
+                    continue;
+                }
+                uint64_t column_size = std::filesystem::file_size(columnar::column_file_path(files[i]), ec);
+                if (ec) {
+                    column_size = 0;
+                }
+
+                auto it = saved.find(id);
+                if (it != saved.end() && it->second.size == size && it->second.column_size == column_size &&
+                    it->second.compressed && column_size > 0) {
+                    add_entry(it->second);
+                    continue;
+                }
+
+                // Segments never sealed are cut back to their last intact
+                // record. The newest one is resumed; its index is rebuilt by
+                // scanning the records. Any other is sealed now.
+                segment::SegmentInfo info;
+                if (!segment::recover_segment(files[i], id, info)) {
+                    continue;
+                }
+
+                if (!info.sealed && i + 1 == files.size()) {
+                    fd_ = ::open(files[i].c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+                    if (fd_ >= 0) {
+                        active_ = std::move(info);
+                        active_day_ = active_.record_count > 0
+                            ? local_day(static_cast<time_t>(active_.first_ts))
+                            : current_day();
+                        continue;
+                    }
+                }
+
+                if (!info.sealed) {
+                    segment::seal_segment(info, sync_.policy != SyncPolicy::NONE);
+                }
+                size = std::filesystem::file_size(files[i], ec);
+
+                add_entry(entry_for(info, size, column_size));
+                if (info.sealed && (!info.compressed || column_size == 0)) {
+                    to_finish_.push_back(std::move(info));
+                }
             }
+            finish_sealed();
+
+            cleanup_old_files();
+            manifest_dirty_ = true;
+            save_manifest();
         } catch (...) {
             // Ignore initialization errors
         }
     }
 
-    std::string get_current_file_path() const {
-        auto now = std::chrono::system_clock::now();
-        auto time = std::chrono::system_clock::to_time_t(now);
-        char buffer[32];
-        std::strftime(buffer, sizeof(buffer), "%Y%m%d", std::localtime(&time));
-        
-        return storage_path_ + "/metrics-" + std::string(buffer) + ".jsonl";
+    // Converts the history left in the JSON-lines files of earlier releases
+    // (metrics-*.jsonl) into sealed segments, then removes the files. The
+    // new segments take the lowest ids, with existing segments renumbered
+    // if needed, so they count towards the retention limits and are the
+    // first to expire. Samples not older than the existing segments are
+    // skipped to keep segments in time order; this also makes an import
+    // interrupted before the files were removed safe to run again.
+    void import_legacy_files() {
+        std::vector<std::string> legacy;
+        for (const auto& entry : std::filesystem::directory_iterator(storage_path_)) {
+            std::string name = entry.path().filename().string();
+            if (entry.is_regular_file() && name.rfind("metrics-", 0) == 0 && name.size() > 6 &&
+                name.compare(name.size() - 6, 6, ".jsonl") == 0) {
+                legacy.push_back(entry.path().string());
+            }
+        }
+        if (legacy.empty()) {
+            return;
+        }
+        std::sort(legacy.begin(), legacy.end());
+
+        auto existing = get_metric_files();
+        uint64_t before_ts = UINT64_MAX;
+        if (!existing.empty()) {
+            segment::SegmentInfo first;
+            uint64_t first_id = segment::parse_segment_id(std::filesystem::path(existing.front()).filename().string());
+            if (segment::load_segment(existing.front(), first_id, first) && first.record_count > 0) {
+                before_ts = first.first_ts;
+            }
+        }
+
+        size_t segment_limit = max_file_size_bytes_ > 0 ? max_file_size_bytes_ : 10 * 1024 * 1024;
+        std::vector<std::string> imported;
+        std::string data;
+        segment::SegmentInfo info;
+        uint64_t last_ts = 0;
+
+        auto write_segment = [&]() {
+            if (info.record_count == 0) {
+                return true;
+            }
+            data += segment::encode_footer(info);
+            std::string path = storage_path_ + "/import-" + std::to_string(imported.size()) + ".seg.tmp";
+            int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            bool ok = fd >= 0 && segment::write_all(fd, data.data(), data.size()) && fdatasync(fd) == 0;
+            if (fd >= 0) {
+                close(fd);
+            }
+            imported.push_back(path);
+            data.clear();
+            info = segment::SegmentInfo();
+            return ok;
+        };
+
+        bool ok = true;
+        for (const auto& path : legacy) {
+            std::ifstream file(path);
+            std::string line;
+            while (ok && std::getline(file, line)) {
+                metrics::SystemMetrics sample;
+                try {
+                    sample = metrics::SystemMetrics::fromJSON(line);
+                } catch (...) {
+                    continue;
+                }
+                if (sample.timestamp >= before_ts || sample.timestamp < last_ts) {
+                    continue;
+                }
+                last_ts = sample.timestamp;
+
+                std::string record;
+                segment::encode_record(record, sample.timestamp, sample.toJSON());
+                if (info.record_count > 0 && data.size() + record.size() > segment_limit) {
+                    ok = write_segment();
+                }
+                if (data.empty()) {
+                    data = segment::encode_header();
+                }
+                segment::index_record(info, data.size(), sample.timestamp, record.size());
+                data += record;
+            }
+        }
+        ok = ok && write_segment();
+
+        std::error_code ec;
+        if (!ok) {
+            for (const auto& path : imported) {
+                std::filesystem::remove(path, ec);
+            }
+            return;
+        }
+
+        // Make room below the existing segments, highest id first so no
+        // rename overwrites a file not yet moved.
+        uint64_t first_id = existing.empty() ? UINT64_MAX
+            : segment::parse_segment_id(std::filesystem::path(existing.front()).filename().string());
+        if (!imported.empty() && first_id <= imported.size()) {
+            uint64_t shift = imported.size() - first_id + 1;
+            for (auto it = existing.rbegin(); it != existing.rend(); ++it) {
+                uint64_t id = segment::parse_segment_id(std::filesystem::path(*it).filename().string());
+                std::string target = segment_path(id + shift);
+                std::filesystem::rename(*it, target, ec);
+                if (std::filesystem::exists(columnar::column_file_path(*it))) {
+                    std::filesystem::rename(columnar::column_file_path(*it), columnar::column_file_path(target), ec);
+                }
+            }
+            std::filesystem::remove(storage_path_ + "/MANIFEST", ec);
+        }
+
+        for (size_t i = 0; i < imported.size(); ++i) {
+            std::filesystem::rename(imported[i], segment_path(i + 1), ec);
+        }
+        for (const auto& path : legacy) {
+            std::filesystem::remove(path, ec);
+        }
+    }
+
+    static int local_day(time_t time) {
+        std::tm tm_buf{};
+        localtime_r(&time, &tm_buf);
+        return (tm_buf.tm_year + 1900) * 1000 + tm_buf.tm_yday;
     }
 
-    bool should_rotate() const {
-        return current_file_size_ >= max_file_size_bytes_;
+    static int current_day() {
+        return local_day(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()));
     }
 
+    // True when appending record_size bytes after the buffered ones would
+    // overflow the active segment, or when it belongs to an earlier day.
+    bool should_rotate(size_t buffered, size_t record_size) const {
+        if (fd_ < 0 || (active_.record_count == 0 && buffered == 0)) {
+            return false;
+        }
+
+        return active_day_ != current_day() ||
+               (max_file_size_bytes_ > 0 &&
+                active_.data_end + buffered + record_size > max_file_size_bytes_);
+    }
+
+    // Seals the active segment by appending its block index and starts the
+    // next one.
     void rotate_files() {
-        auto now = std::chrono::system_clock::now();
-        auto time = std::chrono::system_clock::to_time_t(now);
-        char buffer[64];
-        std::strftime(buffer, sizeof(buffer), "%Y%m%d-%H%M%S", std::localtime(&time));
-        
-        std::string new_file = storage_path_ + "/metrics-" + std::string(buffer) + ".jsonl";
-        current_file_size_ = 0;
-        
-        cleanup_old_files();
+        std::string footer = segment::encode_footer(active_);
+        segment::write_all(fd_, footer.data(), footer.size());
+        if (sync_.policy != SyncPolicy::NONE) {
+            fdatasync(fd_);
+            unsynced_ = 0;
+        }
+        close(fd_);
+        fd_ = -1;
+
+        active_.sealed = true;
+        add_entry(entry_for(active_, active_.data_end + footer.size(), 0));
+        to_finish_.push_back(active_);
+
+        uint64_t next_id = active_.id + 1;
+        active_ = segment::SegmentInfo();
+
+        if (open_segment(next_id)) {
+            remove_old_segments();
+        }
     }
 
-    std::vector<std::string> get_metric_files() const {
-        std::vector<std::string> files;
-        
-        try {
-            for (const auto& entry : std::filesystem::directory_iterator(storage_path_)) {
-                if (entry.is_regular_file() && 
-                    entry.path().filename().string().find("metrics-") == 0) {
-                    files.push_back(entry.path().string());
+    // Deletes the oldest segments while the limits are exceeded. Called
+    // with mutex_ held.
+    void remove_old_segments() {
+        size_t active_files = fd_ >= 0 ? 1 : 0;
+        uint64_t active_bytes = fd_ >= 0 ? active_.data_end : 0;
+
+        size_t first = 0;
+        while (first < manifest_.size() &&
+               (manifest_.size() - first + active_files > max_files_ ||
+                (max_total_size_bytes_ > 0 && manifest_bytes_ + active_bytes > max_total_size_bytes_))) {
+            const ManifestEntry& entry = manifest_[first];
+            std::string path = segment_path(entry.id);
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+            std::filesystem::remove(columnar::column_file_path(path), ec);
+            manifest_records_ -= entry.records;
+            manifest_bytes_ -= entry.size + entry.column_size;
+            ++first;
+        }
+
+        if (first > 0) {
+            manifest_.erase(manifest_.begin(), manifest_.begin() + first);
+            manifest_dirty_ = true;
+        }
+    }
+
+    bool open_segment(uint64_t id) {
+        std::string path = segment_path(id);
+
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+
+        std::string header = segment::encode_header();
+        if (!segment::write_all(fd, header.data(), header.size())) {
+            close(fd);
+            return false;
+        }
+
+        fd_ = fd;
+        active_ = segment::SegmentInfo();
+        active_.path = path;
+        active_.id = id;
+        active_day_ = current_day();
+        return true;
+    }
+
+    // Called with mutex_ held.
+    uint64_t next_segment_id() const {
+        uint64_t max_id = active_.id;
+        if (!manifest_.empty()) {
+            max_id = std::max(max_id, manifest_.back().id);
+        }
+        return max_id + 1;
+    }
+
+    // Block indexes of the segments that may hold records between start and
+    // end, oldest first. The manifest selects the segments; sealed ones are
+    // read from their footers and the active one comes from memory.
+    std::vector<segment::SegmentInfo> get_segments(uint64_t start = 0, uint64_t end = UINT64_MAX) {
+        std::vector<ManifestEntry> entries;
+        segment::SegmentInfo active;
+        bool has_active = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto& entry : manifest_) {
+                if (entry.records > 0 && entry.last_ts >= start && entry.first_ts <= end) {
+                    entries.push_back(entry);
                 }
             }
-            
-            std::sort(files.begin(), files.end());
-        } catch (...) {
-            // Return empty vector on error
+            if (fd_ >= 0) {
+                active = active_;
+                has_active = true;
+            }
         }
 
-        return files;
+        std::vector<segment::SegmentInfo> segments;
+        for (const auto& entry : entries) {
+            segment::SegmentInfo info;
+            if (segment::load_segment(segment_path(entry.id), entry.id, info)) {
+                segments.push_back(std::move(info));
+            }
+        }
+        if (has_active) {
+            segments.push_back(std::move(active));
+        }
+
+        return segments;
     }
 
-    std::vector<metrics::SystemMetrics> read_file(const std::string& file_path, size_t max_count) {
-        std::vector<metrics::SystemMetrics> result;
-        
-        try {
-            std::ifstream file(file_path);
-            if (!file.is_open()) {
-                return result;
+    // The last count samples, oldest first: from memory when the ring holds
+    // that many, from disk otherwise.
+    std::vector<SampleRing::Payload> latest_payloads(size_t count) {
+        std::vector<SampleRing::Payload> payloads;
+        if (!recent_.latest(count, payloads)) {
+            read_latest(count, [&payloads](std::string_view payload) {
+                payloads.push_back(std::make_shared<const std::string>(payload));
+            });
+        }
+        return payloads;
+    }
+
+    // Calls f(payload) for the last count records, oldest first. The record
+    // counts of the active segment and the manifest tell which segments hold
+    // them, so only the tail blocks of those segments are read, and the cost
+    // depends on count rather than on how much is stored.
+    template <typename F>
+    void read_latest(size_t count, F&& f) {
+        std::vector<std::pair<uint64_t, size_t>> wanted;  // segment id and records, newest first
+        segment::SegmentInfo active;
+        size_t from_active = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            size_t remaining = count;
+            if (fd_ >= 0) {
+                active = active_;
+                from_active = std::min<uint64_t>(remaining, active.record_count);
+                remaining -= from_active;
             }
+            for (auto it = manifest_.rbegin(); it != manifest_.rend() && remaining > 0; ++it) {
+                size_t take = std::min<uint64_t>(remaining, it->records);
+                wanted.emplace_back(it->id, take);
+                remaining -= take;
+            }
+        }
 
-            std::string line;
-            while (std::getline(file, line) && (max_count == 0 || result.size() < max_count)) {
-                if (line.empty()) continue;
-                
-                try {
-                    metrics::SystemMetrics m = metrics::SystemMetrics::fromJSON(line);
-                    result.push_back(m);
-                } catch (...) {
-                    // Skip invalid JSON lines
+        auto visit = [&f](uint64_t, std::string_view payload) {
+            f(payload);
+        };
+
+        try {
+            for (auto it = wanted.rbegin(); it != wanted.rend(); ++it) {
+                segment::SegmentInfo info;
+                if (segment::load_segment(segment_path(it->first), it->first, info)) {
+                    segment::read_last(info, it->second, visit);
                 }
             }
+            segment::read_last(active, from_active, visit);
         } catch (...) {
             // Return partial results on error
         }
+    }
 
-        return result;
+    std::vector<std::string> get_metric_files() const {
+        std::vector<std::string> files;
+
+        try {
+            for (const auto& entry : std::filesystem::directory_iterator(storage_path_)) {
+                if (entry.is_regular_file() &&
+                    segment::parse_segment_id(entry.path().filename().string()) != 0) {
+                    files.push_back(entry.path().string());
+                }
+            }
+
+            std::sort(files.begin(), files.end());
+        } catch (...) {
+            // Return empty vector on error
+        }
+
+        return files;
     }
 };
 
@@ -0,0 +1,371 @@
+#pragma once
+
+#include "metrics.h"
+#include "metrics_schema.h"
+#include "segment.h"
+#include "columnar.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <filesystem>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+namespace blinky {
+namespace agent {
+
+enum class Aggregation {
+    AVG,
+    MIN,
+    MAX,
+    LAST
+};
+
+inline Aggregation parse_aggregation(const std::string& value) {
+    if (value == "min") return Aggregation::MIN;
+    if (value == "max") return Aggregation::MAX;
+    if (value == "last") return Aggregation::LAST;
+    return Aggregation::AVG;
+}
+
+// One resolution of downsampled history, e.g. one record per minute. Every
+// numeric series of the samples in a bucket is reduced to min/max/avg/last.
+// Buckets are stored as records in segment files of their own directory,
+// so they get the same time index and compression as raw samples. The
+// indexes of the closed segments are loaded once and kept in memory, and
+// whenever a segment is sealed the sealed ones older than the retention
+// are deleted.
+//
+// Record payload, integers little-endian:
+//   u32 series count
+//   per series: u16 path length | path | u16 labels length | labels |
+//               f64 min | f64 max | f64 sum | f64 last | u32 count
+class RollupTier {
+public:
+    RollupTier(const std::string& path, uint64_t width_seconds, uint64_t retention_seconds)
+        : path_(path)
+        , width_(width_seconds > 0 ? width_seconds : 1)
+        , retention_(retention_seconds) {
+        try {
+            std::filesystem::create_directories(path_);
+
+            auto files = segment_files();
+            for (size_t i = 0; i + 1 < files.size(); ++i) {
+                segment::SegmentInfo info;
+                uint64_t id = segment::parse_segment_id(std::filesystem::path(files[i]).filename().string());
+                if (segment::load_segment(files[i], id, info)) {
+                    closed_.push_back(std::move(info));
+                }
+            }
+            if (!files.empty()) {
+                segment::SegmentInfo info;
+                uint64_t id = segment::parse_segment_id(std::filesystem::path(files.back()).filename().string());
+                active_.id = id;
+                if (segment::recover_segment(files.back(), id, info)) {
+                    last_bucket_ = info.record_count > 0 ? info.last_ts : 0;
+                    if (!info.sealed) {
+                        fd_ = ::open(files.back().c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+                    }
+                    if (fd_ >= 0) {
+                        active_ = std::move(info);
+                    } else {
+                        closed_.push_back(std::move(info));
+                    }
+                }
+            }
+        } catch (...) {
+            // Ignore initialization errors
+        }
+        apply_retention();
+    }
+
+    ~RollupTier() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    RollupTier(const RollupTier&) = delete;
+    RollupTier& operator=(const RollupTier&) = delete;
+
+    uint64_t width() const { return width_; }
+
+    // Start of the newest bucket already written, 0 if none.
+    uint64_t last_bucket() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return last_bucket_;
+    }
+
+    // Folds a sample into the open bucket. The bucket is written once a
+    // sample from a later bucket arrives; samples older than the last
+    // written bucket are ignored.
+    void add(const metrics::SystemMetrics& sample) {
+        uint64_t timestamp = static_cast<uint64_t>(sample.timestamp);
+        uint64_t bucket = timestamp - timestamp % width_;
+
+        if (last_bucket_ != 0 && bucket <= last_bucket_) {
+            return;
+        }
+
+        if (!pending_.empty() && bucket != pending_bucket_) {
+            write_bucket();
+        }
+
+        pending_bucket_ = bucket;
+        metrics::schema::forEachSeries(sample,
+            [this](const std::string& path, const std::string& labels, double value) {
+                Aggregate& agg = pending_[{path, labels}];
+                if (agg.count == 0) {
+                    agg.min = value;
+                    agg.max = value;
+                } else {
+                    agg.min = std::min(agg.min, value);
+                    agg.max = std::max(agg.max, value);
+                }
+                agg.sum += value;
+                agg.last = value;
+                agg.count += 1;
+            });
+    }
+
+    // One point per bucket in [start, end] for every series with the given
+    // path, keyed by labels. Points are stamped with the bucket start.
+    void read_series(const std::string& series, uint64_t start, uint64_t end, Aggregation aggregation,
+                     std::map<std::string, std::vector<columnar::Point>>& result) {
+        std::vector<segment::SegmentInfo> infos;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            infos = closed_;
+            if (fd_ >= 0) {
+                infos.push_back(active_);
+            }
+        }
+
+        for (const auto& info : infos) {
+            segment::read_range(info, start, end, [&](uint64_t bucket, std::string_view payload) {
+                decode(payload, [&](std::string_view path, std::string_view labels, const Aggregate& agg) {
+                    if (path != series || agg.count == 0) {
+                        return;
+                    }
+
+                    double value;
+                    switch (aggregation) {
+                        case Aggregation::MIN: value = agg.min; break;
+                        case Aggregation::MAX: value = agg.max; break;
+                        case Aggregation::LAST: value = agg.last; break;
+                        default: value = agg.sum / agg.count; break;
+                    }
+                    result[std::string(labels)].push_back({bucket, value});
+                });
+            });
+        }
+    }
+
+private:
+    struct Aggregate {
+        double min = 0;
+        double max = 0;
+        double sum = 0;
+        double last = 0;
+        uint32_t count = 0;
+    };
+
+    static constexpr uint64_t SEGMENT_SIZE = 4 * 1024 * 1024;
+
+    std::string path_;
+    uint64_t width_;
+    uint64_t retention_;
+
+    // Guards the active segment against concurrent readers. The pending
+    // bucket is only touched by the writer thread.
+    std::mutex mutex_;
+    segment::SegmentInfo active_;
+    std::vector<segment::SegmentInfo> closed_;  // every other segment, oldest first
+    int fd_ = -1;
+    uint64_t last_bucket_ = 0;
+
+    std::map<std::pair<std::string, std::string>, Aggregate> pending_;
+    uint64_t pending_bucket_ = 0;
+
+    void write_bucket() {
+        std::string payload;
+        segment::put_le(payload, pending_.size(), 4);
+        for (const auto& entry : pending_) {
+            segment::put_le(payload, entry.first.first.size(), 2);
+            payload += entry.first.first;
+            segment::put_le(payload, entry.first.second.size(), 2);
+            payload += entry.first.second;
+            for (double value : {entry.second.min, entry.second.max, entry.second.sum, entry.second.last}) {
+                segment::put_le(payload, columnar::double_bits(value), 8);
+            }
+            segment::put_le(payload, entry.second.count, 4);
+        }
+        pending_.clear();
+
+        std::string record;
+        segment::encode_record(record, pending_bucket_, payload);
+
+        std::vector<segment::SegmentInfo> sealed;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            if (fd_ >= 0 && active_.record_count > 0 &&
+                (active_.data_end + record.size() > SEGMENT_SIZE ||
+                 pending_bucket_ - active_.first_ts >= segment_span())) {
+                sealed.push_back(seal());
+            }
+
+            if (fd_ < 0 && !open_segment()) {
+                return;
+            }
+
+            if (segment::write_all(fd_, record.data(), record.size())) {
+                segment::index_record(active_, active_.data_end, pending_bucket_, record.size());
+                last_bucket_ = pending_bucket_;
+            } else if (ftruncate(fd_, active_.data_end) != 0) {
+                close(fd_);
+                fd_ = -1;
+            }
+        }
+
+        for (const auto& info : sealed) {
+            segment::SegmentInfo compressed;
+            if (segment::compress_segment(info, false, compressed)) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (auto& closed : closed_) {
+                    if (closed.id == compressed.id) {
+                        closed = std::move(compressed);
+                        break;
+                    }
+                }
+            }
+        }
+        if (!sealed.empty()) {
+            apply_retention();
+        }
+    }
+
+    // Each segment covers a fraction of the retention so expired data can
+    // be dropped a whole file at a time.
+    uint64_t segment_span() const {
+        return std::max<uint64_t>(retention_ / 16, width_ * 64);
+    }
+
+    segment::SegmentInfo seal() {
+        std::string footer = segment::encode_footer(active_);
+        segment::write_all(fd_, footer.data(), footer.size());
+        close(fd_);
+        fd_ = -1;
+
+        segment::SegmentInfo sealed = active_;
+        sealed.sealed = true;
+        closed_.push_back(sealed);
+        active_ = segment::SegmentInfo();
+        active_.id = sealed.id;
+        return sealed;
+    }
+
+    bool open_segment() {
+        uint64_t id = active_.id + 1;
+
+        std::string path = path_ + "/" + segment::segment_file_name(id);
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+
+        std::string header = segment::encode_header();
+        if (!segment::write_all(fd, header.data(), header.size())) {
+            close(fd);
+            return false;
+        }
+
+        fd_ = fd;
+        active_ = segment::SegmentInfo();
+        active_.path = path;
+        active_.id = id;
+        return true;
+    }
+
+    void apply_retention() {
+        if (retention_ == 0 || last_bucket_ < retention_) {
+            return;
+        }
+
+        uint64_t cutoff = last_bucket_ - retention_;
+        std::vector<std::string> expired;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto kept = std::remove_if(closed_.begin(), closed_.end(), [&](const segment::SegmentInfo& info) {
+                if (info.sealed && info.last_ts < cutoff) {
+                    expired.push_back(info.path);
+                    return true;
+                }
+                return false;
+            });
+            closed_.erase(kept, closed_.end());
+        }
+        for (const auto& path : expired) {
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+        }
+    }
+
+    std::vector<std::string> segment_files() const {
+        std::vector<std::string> files;
+        try {
+            for (const auto& entry : std::filesystem::directory_iterator(path_)) {
+                if (entry.is_regular_file() &&
+                    segment::parse_segment_id(entry.path().filename().string()) != 0) {
+                    files.push_back(entry.path().string());
+                }
+            }
+            std::sort(files.begin(), files.end());
+        } catch (...) {
+            // Return what was found
+        }
+        return files;
+    }
+
+    template <typename F>
+    static void decode(std::string_view payload, F&& f) {
+        size_t pos = 0;
+        auto take = [&](size_t bytes) -> const char* {
+            if (payload.size() - pos < bytes) {
+                return nullptr;
+            }
+            const char* p = payload.data() + pos;
+            pos += bytes;
+            return p;
+        };
+
+        const char* p = take(4);
+        size_t count = p ? segment::get_le(p, 4) : 0;
+        for (size_t i = 0; i < count; ++i) {
+            const char* len = take(2);
+            size_t path_len = len ? segment::get_le(len, 2) : 0;
+            const char* path = len ? take(path_len) : nullptr;
+            len = path ? take(2) : nullptr;
+            size_t labels_len = len ? segment::get_le(len, 2) : 0;
+            const char* labels = len ? take(labels_len) : nullptr;
+            const char* values = labels ? take(36) : nullptr;
+            if (!values) {
+                return;
+            }
+
+            Aggregate agg;
+            agg.min = columnar::bits_double(segment::get_le(values, 8));
+            agg.max = columnar::bits_double(segment::get_le(values + 8, 8));
+            agg.sum = columnar::bits_double(segment::get_le(values + 16, 8));
+            agg.last = columnar::bits_double(segment::get_le(values + 24, 8));
+            agg.count = static_cast<uint32_t>(segment::get_le(values + 32, 4));
+            f(std::string_view(path, path_len), std::string_view(labels, labels_len), agg);
+        }
+    }
+};
+
+}
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "protocol.h"
+#include <string>
+#include <deque>
+#include <chrono>
+#include <cstdint>
+
+namespace blinky {
+namespace agent {
+
+// Accumulates serialized samples for the push path so several of them can
+// go out in one METRICS_BATCH frame. While the collector is unreachable the
+// buffer keeps the most recent max_samples samples.
+class SampleBatcher {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    SampleBatcher(size_t max_samples = 100,
+                  std::chrono::milliseconds window = std::chrono::milliseconds(0))
+        : max_samples_(max_samples > 0 ? max_samples : 1)
+        , window_(window) {
+    }
+
+    void add(uint64_t timestamp, std::string payload) {
+        if (samples_.empty()) {
+            first_added_ = Clock::now();
+        }
+
+        samples_.push_back({timestamp, std::move(payload)});
+
+        if (samples_.size() > max_samples_) {
+            samples_.pop_front();
+        }
+    }
+
+    // True when the batch is full, or when holding it until the next sample
+    // arrives would exceed the batching window.
+    bool ready(Clock::time_point next_sample_at) const {
+        if (samples_.empty()) {
+            return false;
+        }
+
+        if (samples_.size() >= max_samples_) {
+            return true;
+        }
+
+        return next_sample_at - first_added_ >= window_;
+    }
+
+    // Builds the frame for everything buffered. Samples stay buffered until
+    // clear() so a failed send can be retried after reconnecting.
+    protocol::Message build(const std::string& hostname, const std::string& version) const {
+        protocol::Message msg;
+        msg.hostname = hostname;
+        msg.version = version;
+        msg.timestamp = samples_.back().timestamp;
+
+        if (samples_.size() == 1) {
+            msg.type = protocol::MessageType::METRICS;
+            msg.payload = samples_.front().payload;
+        } else {
+            msg.type = protocol::MessageType::METRICS_BATCH;
+
+            size_t total = 0;
+            for (const auto& sample : samples_) {
+                total += sample.payload.size() + 12;
+            }
+            msg.payload.reserve(total);
+
+            for (const auto& sample : samples_) {
+                protocol::appendBatchEntry(msg.payload, sample.timestamp, sample.payload);
+            }
+        }
+
+        return msg;
+    }
+
+    void clear() {
+        samples_.clear();
+    }
+
+    size_t size() const {
+        return samples_.size();
+    }
+
+private:
+    struct Sample {
+        uint64_t timestamp;
+        std::string payload;
+    };
+
+    size_t max_samples_;
+    std::chrono::milliseconds window_;
+    std::deque<Sample> samples_;
+    Clock::time_point first_added_;
+};
+
+}
+}
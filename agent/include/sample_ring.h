@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+namespace blinky {
+namespace agent {
+
+// Fixed-size ring of the most recent samples, each held as the JSON it was
+// serialized to once when stored. Readers get shared references, so a hot
+// API read copies pointers rather than payloads and never touches the disk.
+class SampleRing {
+public:
+    using Payload = std::shared_ptr<const std::string>;
+
+    explicit SampleRing(size_t capacity)
+        : slots_(capacity) {
+    }
+
+    SampleRing(const SampleRing&) = delete;
+    SampleRing& operator=(const SampleRing&) = delete;
+
+    size_t capacity() const {
+        return slots_.size();
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return size_;
+    }
+
+    // Adds the newest sample, replacing the oldest once the ring is full.
+    void push(Payload json) {
+        if (slots_.empty()) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_[next_] = std::move(json);
+        next_ = (next_ + 1) % slots_.size();
+        size_ = std::min(size_ + 1, slots_.size());
+    }
+
+    // The count newest samples, oldest first. Returns false without touching
+    // out when the ring holds fewer than count.
+    bool latest(size_t count, std::vector<Payload>& out) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (slots_.empty() || count > size_) {
+            return false;
+        }
+
+        out.reserve(out.size() + count);
+        size_t index = (next_ + slots_.size() - count) % slots_.size();
+        for (size_t i = 0; i < count; ++i) {
+            out.push_back(slots_[index]);
+            index = (index + 1) % slots_.size();
+        }
+        return true;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<Payload> slots_;
+    size_t next_ = 0;
+    size_t size_ = 0;
+};
+
+}
+}
@@ -0,0 +1,659 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+namespace blinky {
+namespace agent {
+namespace segment {
+
+// On-disk layout of a metrics segment, all integers little-endian:
+//
+//   header   "BLKYSEG1" | u32 format version | u32 flags
+//   records  u32 payload length | u64 timestamp | payload | u32 CRC32C |
+//            u32 payload length
+//   footer   block index entries, written when the segment is sealed
+//   trailer  u64 index offset | u32 block count | u32 reserved |
+//            u64 first timestamp | u64 last timestamp | u64 record count |
+//            "BLKYIDX1"
+//
+// The CRC32C covers the length, timestamp and payload. The trailing copy of
+// the length is the record's commit marker: a record only counts once both
+// lengths agree and the checksum matches, so a write torn by a crash or
+// power loss is recognized and cut off. Records are grouped into blocks of
+// roughly BLOCK_SIZE bytes. The footer holds one index entry per block, so
+// a time range query binary-searches the index and reads only the blocks it
+// needs. The active segment has no footer yet; its block index is kept in
+// memory by the writer. Readers skip a block holding a corrupt record and
+// carry on with the next.
+//
+// Sealed segments are rewritten compressed (FLAG_COMPRESSED). The header is
+// then followed by u32 dictionary length | dictionary, and every block is
+// stored as u32 uncompressed size | deflate stream primed with that
+// dictionary, so each block can be decompressed on its own. Index offsets
+// and sizes then refer to the compressed blocks.
+
+constexpr char HEADER_MAGIC[] = "BLKYSEG1";
+constexpr char TRAILER_MAGIC[] = "BLKYIDX1";
+constexpr uint32_t FORMAT_VERSION = 2;
+constexpr uint32_t FLAG_COMPRESSED = 0x0001;
+
+constexpr size_t HEADER_SIZE = 16;
+constexpr size_t RECORD_HEADER_SIZE = 12;
+constexpr size_t RECORD_TRAILER_SIZE = 8;
+constexpr size_t RECORD_OVERHEAD = RECORD_HEADER_SIZE + RECORD_TRAILER_SIZE;
+constexpr size_t INDEX_ENTRY_SIZE = 32;
+constexpr size_t TRAILER_SIZE = 48;
+constexpr size_t BLOCK_SIZE = 64 * 1024;
+constexpr size_t MAX_DICTIONARY_SIZE = 32 * 1024;
+
+struct BlockIndex {
+    uint64_t first_ts = 0;
+    uint64_t last_ts = 0;
+    uint64_t offset = 0;
+    uint32_t size = 0;
+    uint32_t count = 0;
+};
+
+struct SegmentInfo {
+    std::string path;
+    uint64_t id = 0;
+    bool sealed = false;
+    bool compressed = false;
+    uint64_t first_ts = 0;
+    uint64_t last_ts = 0;
+    uint64_t record_count = 0;
+    uint64_t data_end = HEADER_SIZE;
+    std::vector<BlockIndex> blocks;
+    std::string dictionary;
+};
+
+inline void put_le(std::string& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+    }
+}
+
+inline uint64_t get_le(const char* data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(static_cast<uint8_t>(data[i])) << (i * 8);
+    }
+    return value;
+}
+
+inline const uint32_t* crc32c_table() {
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> t{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; ++k) {
+                crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+            }
+            t[i] = crc;
+        }
+        return t;
+    }();
+    return table.data();
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+__attribute__((target("sse4.2")))
+inline uint32_t crc32c_sse42(uint32_t crc, const char* data, size_t size) {
+    uint64_t crc64 = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+    }
+    crc = static_cast<uint32_t>(crc64);
+    for (; size > 0; ++data, --size) {
+        crc = __builtin_ia32_crc32qi(crc, static_cast<uint8_t>(*data));
+    }
+    return crc;
+}
+#endif
+
+// CRC32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has
+// it, a table otherwise.
+inline uint32_t crc32c(const char* data, size_t size, uint32_t crc = 0) {
+    crc = ~crc;
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    static const bool sse42 = __builtin_cpu_supports("sse4.2");
+    if (sse42) {
+        return ~crc32c_sse42(crc, data, size);
+    }
+#endif
+    const uint32_t* table = crc32c_table();
+    for (; size > 0; ++data, --size) {
+        crc = table[(crc ^ static_cast<uint8_t>(*data)) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+inline bool read_exact(int fd, char* buf, size_t len, uint64_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+inline bool write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, buf, len);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+inline std::string segment_file_name(uint64_t id) {
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "segment-%08llu.seg", static_cast<unsigned long long>(id));
+    return buffer;
+}
+
+// Returns 0 for names that are not segment files.
+inline uint64_t parse_segment_id(const std::string& file_name) {
+    if (file_name.rfind("segment-", 0) != 0 || file_name.size() < 13 ||
+        file_name.compare(file_name.size() - 4, 4, ".seg") != 0) {
+        return 0;
+    }
+    return std::strtoull(file_name.c_str() + 8, nullptr, 10);
+}
+
+inline std::string encode_header(uint32_t flags = 0) {
+    std::string header(HEADER_MAGIC, 8);
+    put_le(header, FORMAT_VERSION, 4);
+    put_le(header, flags, 4);
+    return header;
+}
+
+inline void encode_record(std::string& out, uint64_t timestamp, std::string_view payload) {
+    size_t start = out.size();
+    put_le(out, payload.size(), 4);
+    put_le(out, timestamp, 8);
+    out.append(payload);
+    put_le(out, crc32c(out.data() + start, out.size() - start), 4);
+    put_le(out, payload.size(), 4);
+}
+
+// Size of the intact record at the start of data, or 0 if it is incomplete
+// or fails its checksum.
+inline size_t check_record(const char* data, size_t available) {
+    if (available < RECORD_OVERHEAD) {
+        return 0;
+    }
+
+    size_t len = get_le(data, 4);
+    if (available - RECORD_OVERHEAD < len) {
+        return 0;
+    }
+
+    const char* trailer = data + RECORD_HEADER_SIZE + len;
+    if (get_le(trailer + 4, 4) != len ||
+        get_le(trailer, 4) != crc32c(data, RECORD_HEADER_SIZE + len)) {
+        return 0;
+    }
+    return RECORD_OVERHEAD + len;
+}
+
+// Updates the in-memory block index after a record was appended at offset.
+inline void index_record(SegmentInfo& info, uint64_t offset, uint64_t timestamp, size_t record_size) {
+    if (info.blocks.empty() || info.blocks.back().size >= BLOCK_SIZE) {
+        BlockIndex block;
+        block.first_ts = timestamp;
+        block.offset = offset;
+        info.blocks.push_back(block);
+    }
+
+    BlockIndex& block = info.blocks.back();
+    block.last_ts = std::max(block.last_ts, timestamp);
+    block.size += static_cast<uint32_t>(record_size);
+    block.count += 1;
+
+    if (info.record_count == 0) {
+        info.first_ts = timestamp;
+    }
+    info.last_ts = std::max(info.last_ts, timestamp);
+    info.record_count += 1;
+    info.data_end = offset + record_size;
+}
+
+inline std::string encode_footer(const SegmentInfo& info) {
+    std::string footer;
+    footer.reserve(info.blocks.size() * INDEX_ENTRY_SIZE + TRAILER_SIZE);
+
+    for (const auto& block : info.blocks) {
+        put_le(footer, block.first_ts, 8);
+        put_le(footer, block.last_ts, 8);
+        put_le(footer, block.offset, 8);
+        put_le(footer, block.size, 4);
+        put_le(footer, block.count, 4);
+    }
+
+    put_le(footer, info.data_end, 8);
+    put_le(footer, info.blocks.size(), 4);
+    put_le(footer, 0, 4);
+    put_le(footer, info.first_ts, 8);
+    put_le(footer, info.last_ts, 8);
+    put_le(footer, info.record_count, 8);
+    footer.append(TRAILER_MAGIC, 8);
+
+    return footer;
+}
+
+// Compresses one block of records into out as u32 size | deflate stream.
+inline bool deflate_block(std::string_view raw, const std::string& dictionary, std::string& out) {
+    z_stream zs{};
+    if (deflateInit(&zs, Z_BEST_COMPRESSION) != Z_OK) {
+        return false;
+    }
+
+    bool ok = dictionary.empty() ||
+        deflateSetDictionary(&zs, reinterpret_cast<const Bytef*>(dictionary.data()),
+                             static_cast<uInt>(dictionary.size())) == Z_OK;
+
+    size_t start = out.size();
+    put_le(out, raw.size(), 4);
+    out.resize(start + 4 + deflateBound(&zs, raw.size()));
+
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(raw.data()));
+    zs.avail_in = static_cast<uInt>(raw.size());
+    zs.next_out = reinterpret_cast<Bytef*>(&out[start + 4]);
+    zs.avail_out = static_cast<uInt>(out.size() - start - 4);
+
+    ok = ok && deflate(&zs, Z_FINISH) == Z_STREAM_END;
+    out.resize(ok ? start + 4 + zs.total_out : start);
+    deflateEnd(&zs);
+    return ok;
+}
+
+inline bool inflate_block(const char* data, size_t size, const std::string& dictionary, std::string& raw) {
+    if (size < 4) {
+        return false;
+    }
+
+    raw.assign(get_le(data, 4), '\0');
+
+    z_stream zs{};
+    if (inflateInit(&zs) != Z_OK) {
+        return false;
+    }
+
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + 4));
+    zs.avail_in = static_cast<uInt>(size - 4);
+    zs.next_out = reinterpret_cast<Bytef*>(&raw[0]);
+    zs.avail_out = static_cast<uInt>(raw.size());
+
+    int ret = inflate(&zs, Z_FINISH);
+    if (ret == Z_NEED_DICT) {
+        ret = inflateSetDictionary(&zs, reinterpret_cast<const Bytef*>(dictionary.data()),
+                                   static_cast<uInt>(dictionary.size()));
+        if (ret == Z_OK) {
+            ret = inflate(&zs, Z_FINISH);
+        }
+    }
+
+    bool ok = ret == Z_STREAM_END && zs.total_out == raw.size();
+    inflateEnd(&zs);
+    return ok;
+}
+
+// Walks the records in a buffer that starts at file offset base. Stops at
+// the first record that is incomplete or corrupt and returns false.
+template <typename F>
+inline bool scan_buffer(std::string_view data, uint64_t base, F&& f) {
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t size = check_record(data.data() + pos, data.size() - pos);
+        if (size == 0) {
+            return false;
+        }
+        f(base + pos, get_le(data.data() + pos + 4, 8),
+          data.substr(pos + RECORD_HEADER_SIZE, size - RECORD_OVERHEAD));
+        pos += size;
+    }
+    return true;
+}
+
+// Walks the records in [begin, end) of an open uncompressed segment file.
+template <typename F>
+inline bool scan_records(int fd, uint64_t begin, uint64_t end, F&& f) {
+    if (end <= begin) {
+        return true;
+    }
+
+    std::string data(end - begin, '\0');
+    if (!read_exact(fd, &data[0], data.size(), begin)) {
+        return false;
+    }
+
+    return scan_buffer(data, begin, f);
+}
+
+// Reads the records of one block into raw, decompressing it if needed.
+inline bool read_block(int fd, const SegmentInfo& info, const BlockIndex& block, std::string& raw) {
+    if (!info.compressed) {
+        raw.assign(block.size, '\0');
+        return read_exact(fd, &raw[0], raw.size(), block.offset);
+    }
+
+    std::string data(block.size, '\0');
+    return read_exact(fd, &data[0], data.size(), block.offset) &&
+           inflate_block(data.data(), data.size(), info.dictionary, raw);
+}
+
+// Opens a segment for reading and checks it still has the layout info was
+// loaded from; a sealed segment may have been replaced by its compressed
+// copy in the meantime. Readers then reload the info with reload_replaced
+// and read the segment again.
+inline int open_for_read(const SegmentInfo& info) {
+    int fd = ::open(info.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    char header[HEADER_SIZE];
+    if (!read_exact(fd, header, HEADER_SIZE, 0) ||
+        ((get_le(header + 12, 4) & FLAG_COMPRESSED) != 0) != info.compressed) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Loads the block index of a segment: from the footer when it is sealed,
+// otherwise by scanning its records. The index of an unsealed segment ends
+// at the last intact record; anything after it is a torn write.
+inline bool load_segment(const std::string& path, uint64_t id, SegmentInfo& info) {
+    info = SegmentInfo();
+    info.path = path;
+    info.id = id;
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= HEADER_SIZE;
+
+    char header[HEADER_SIZE];
+    ok = ok && read_exact(fd, header, HEADER_SIZE, 0) && std::memcmp(header, HEADER_MAGIC, 8) == 0 &&
+         get_le(header + 8, 4) == FORMAT_VERSION;
+    info.compressed = ok && (get_le(header + 12, 4) & FLAG_COMPRESSED) != 0;
+
+    uint64_t file_size = ok ? static_cast<uint64_t>(st.st_size) : 0;
+    char trailer[TRAILER_SIZE];
+    if (ok && file_size >= HEADER_SIZE + TRAILER_SIZE &&
+        read_exact(fd, trailer, TRAILER_SIZE, file_size - TRAILER_SIZE) &&
+        std::memcmp(trailer + TRAILER_SIZE - 8, TRAILER_MAGIC, 8) == 0) {
+        info.sealed = true;
+        info.data_end = get_le(trailer, 8);
+        size_t block_count = get_le(trailer + 8, 4);
+        info.first_ts = get_le(trailer + 16, 8);
+        info.last_ts = get_le(trailer + 24, 8);
+        info.record_count = get_le(trailer + 32, 8);
+
+        // Check the trailer against the file before trusting its counts,
+        // so a corrupt one cannot make us allocate an arbitrary index.
+        ok = info.data_end >= HEADER_SIZE && info.data_end <= file_size - TRAILER_SIZE &&
+             block_count == (file_size - TRAILER_SIZE - info.data_end) / INDEX_ENTRY_SIZE &&
+             (file_size - TRAILER_SIZE - info.data_end) % INDEX_ENTRY_SIZE == 0;
+
+        std::string index(ok ? block_count * INDEX_ENTRY_SIZE : 0, '\0');
+        ok = ok && read_exact(fd, &index[0], index.size(), info.data_end);
+        if (ok) {
+            info.blocks.reserve(block_count);
+        }
+        for (size_t i = 0; ok && i < block_count; ++i) {
+            const char* entry = index.data() + i * INDEX_ENTRY_SIZE;
+            BlockIndex block;
+            block.first_ts = get_le(entry, 8);
+            block.last_ts = get_le(entry + 8, 8);
+            block.offset = get_le(entry + 16, 8);
+            block.size = static_cast<uint32_t>(get_le(entry + 24, 4));
+            block.count = static_cast<uint32_t>(get_le(entry + 28, 4));
+            info.blocks.push_back(block);
+        }
+
+        if (ok && info.compressed) {
+            char length[4];
+            ok = read_exact(fd, length, 4, HEADER_SIZE);
+            size_t dictionary_size = ok ? get_le(length, 4) : 0;
+            ok = ok && dictionary_size <= MAX_DICTIONARY_SIZE;
+            if (ok && dictionary_size > 0) {
+                info.dictionary.assign(dictionary_size, '\0');
+                ok = read_exact(fd, &info.dictionary[0], dictionary_size, HEADER_SIZE + 4);
+            }
+        }
+    } else if (ok && !info.compressed) {
+        scan_records(fd, HEADER_SIZE, file_size,
+            [&info](uint64_t offset, uint64_t timestamp, std::string_view payload) {
+                index_record(info, offset, timestamp, RECORD_OVERHEAD + payload.size());
+            });
+    } else {
+        ok = false;
+    }
+
+    close(fd);
+    return ok;
+}
+
+// Loads the current index of a segment that open_for_read refused because
+// it was compressed after info was loaded. False if it was not replaced
+// that way (it is gone, or unreadable), so readers retry at most once.
+inline bool reload_replaced(const SegmentInfo& info, SegmentInfo& current) {
+    return !info.compressed && load_segment(info.path, info.id, current) && current.compressed;
+}
+
+// Loads a segment left unsealed by a restart and truncates it after its
+// last intact record, so appending resumes on a record boundary. Only this
+// file is scanned, so recovery takes time bounded by the segment size, not
+// by how much history is stored.
+inline bool recover_segment(const std::string& path, uint64_t id, SegmentInfo& info) {
+    if (!load_segment(path, id, info)) {
+        return false;
+    }
+
+    struct stat st;
+    if (!info.sealed && stat(path.c_str(), &st) == 0 && static_cast<uint64_t>(st.st_size) > info.data_end) {
+        return truncate(path.c_str(), static_cast<off_t>(info.data_end)) == 0;
+    }
+    return true;
+}
+
+// Appends the block index to a recovered segment that is not going to be
+// written to again.
+inline bool seal_segment(SegmentInfo& info, bool sync) {
+    int fd = ::open(info.path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    std::string footer = encode_footer(info);
+    bool ok = write_all(fd, footer.data(), footer.size()) && (!sync || fdatasync(fd) == 0);
+    close(fd);
+
+    info.sealed = ok;
+    return ok;
+}
+
+// Rewrites a sealed segment with every block compressed on its own. The
+// first record serves as the deflate dictionary, since all samples share
+// the same keys and most of their values. The copy replaces the original
+// by rename, so readers see either the old or the new file.
+inline bool compress_segment(const SegmentInfo& info, bool sync, SegmentInfo& result) {
+    if (!info.sealed || info.compressed) {
+        return false;
+    }
+
+    int in = ::open(info.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return false;
+    }
+
+    std::string out = encode_header(FLAG_COMPRESSED);
+    std::string dictionary;
+    std::string raw;
+
+    if (!info.blocks.empty() && read_block(in, info, info.blocks.front(), raw)) {
+        scan_buffer(raw, 0, [&dictionary](uint64_t, uint64_t, std::string_view payload) {
+            if (dictionary.empty()) {
+                dictionary.assign(payload.substr(0, MAX_DICTIONARY_SIZE));
+            }
+        });
+    }
+    put_le(out, dictionary.size(), 4);
+    out += dictionary;
+
+    result = info;
+    result.compressed = true;
+    result.dictionary = dictionary;
+
+    bool ok = true;
+    for (auto& block : result.blocks) {
+        ok = read_block(in, info, block, raw);
+        if (!ok) {
+            break;
+        }
+
+        block.offset = out.size();
+        ok = deflate_block(raw, dictionary, out);
+        if (!ok) {
+            break;
+        }
+        block.size = static_cast<uint32_t>(out.size() - block.offset);
+    }
+    close(in);
+
+    if (!ok) {
+        return false;
+    }
+
+    result.data_end = out.size();
+    out += encode_footer(result);
+
+    std::string tmp_path = info.path + ".tmp";
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    ok = write_all(fd, out.data(), out.size()) && (!sync || fdatasync(fd) == 0);
+    close(fd);
+
+    if (!ok || std::rename(tmp_path.c_str(), info.path.c_str()) != 0) {
+        std::remove(tmp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+// Calls f(timestamp, payload) for every record of the segment whose
+// timestamp lies in [start, end], in file order. Timestamps come from the
+// wall clock and are non-decreasing, so the first candidate block is found
+// by binary search on the block index. A block that cannot be read or holds
+// a corrupt record is skipped from that record on; returns false if any
+// was.
+template <typename F>
+inline bool read_range(const SegmentInfo& info, uint64_t start, uint64_t end, F&& f) {
+    if (info.record_count == 0 || info.last_ts < start || info.first_ts > end) {
+        return true;
+    }
+
+    auto first = std::lower_bound(info.blocks.begin(), info.blocks.end(), start,
+        [](const BlockIndex& block, uint64_t ts) { return block.last_ts < ts; });
+
+    int fd = open_for_read(info);
+    if (fd < 0) {
+        SegmentInfo current;
+        return reload_replaced(info, current) && read_range(current, start, end, f);
+    }
+
+    bool ok = true;
+    std::string raw;
+    for (auto it = first; it != info.blocks.end() && it->first_ts <= end; ++it) {
+        if (!read_block(fd, info, *it, raw) ||
+            !scan_buffer(raw, it->offset, [&](uint64_t, uint64_t timestamp, std::string_view payload) {
+                if (timestamp >= start && timestamp <= end) {
+                    f(timestamp, payload);
+                }
+            })) {
+            ok = false;
+        }
+    }
+
+    close(fd);
+    return ok;
+}
+
+// Calls f(timestamp, payload) for the last count records of the segment,
+// oldest first. The block index gives the number of records per block, so
+// only the blocks holding them are read, one at a time. Returns the number
+// of records visited.
+template <typename F>
+inline size_t read_last(const SegmentInfo& info, size_t count, F&& f) {
+    if (count == 0 || info.blocks.empty()) {
+        return 0;
+    }
+
+    auto block = info.blocks.end();
+    size_t available = 0;
+    while (block != info.blocks.begin() && available < count) {
+        --block;
+        available += block->count;
+    }
+    size_t skip = available > count ? available - count : 0;
+
+    int fd = open_for_read(info);
+    if (fd < 0) {
+        SegmentInfo current;
+        return reload_replaced(info, current) ? read_last(current, count, f) : 0;
+    }
+
+    size_t visited = 0;
+    std::string raw;
+    for (; block != info.blocks.end(); ++block) {
+        if (!read_block(fd, info, *block, raw)) {
+            continue;
+        }
+        scan_buffer(raw, block->offset, [&](uint64_t, uint64_t timestamp, std::string_view payload) {
+            if (skip > 0) {
+                --skip;
+                return;
+            }
+            f(timestamp, payload);
+            ++visited;
+        });
+    }
+
+    close(fd);
+    return visited;
+}
+
+}
+}
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include "metrics.h"
+#include "shm_metrics.h"
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace blinky {
+namespace agent {
+
+// Writes every collected sample into the shared-memory segment described in
+// shm_metrics.h, so local consumers can read the latest numbers without
+// going through the HTTP API. Only the collection thread publishes.
+class ShmPublisher {
+public:
+    ShmPublisher(std::string path, size_t payload_capacity)
+        : path_(std::move(path)), payload_capacity_(payload_capacity) {
+    }
+
+    ~ShmPublisher() {
+        close();
+    }
+
+    ShmPublisher(const ShmPublisher&) = delete;
+    ShmPublisher& operator=(const ShmPublisher&) = delete;
+
+    // Builds a fresh segment next to the path and renames it into place, so
+    // readers still mapping a previous agent's segment are not disturbed.
+    // The segment usually lives in a world-writable directory and the agent
+    // runs as root, so the temporary file gets an unpredictable name and is
+    // created exclusively: a planted file or symlink makes mkostemp pick
+    // another name instead of being opened.
+    bool open() {
+        std::string temp_path = path_ + ".XXXXXX";
+        int fd = mkostemp(&temp_path[0], O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+
+        size_t size = shm::segmentSize(payload_capacity_);
+        if (fchmod(fd, 0644) != 0 || ftruncate(fd, size) != 0) {
+            ::close(fd);
+            unlink(temp_path.c_str());
+            return false;
+        }
+
+        void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            unlink(temp_path.c_str());
+            return false;
+        }
+
+        base_ = static_cast<char*>(addr);
+        size_ = size;
+
+        auto* h = header();
+        h->magic = shm::MAGIC;
+        h->version = shm::FORMAT_VERSION;
+        h->header_size = sizeof(shm::SegmentHeader);
+        h->slot_size = static_cast<uint32_t>(shm::slotSize(payload_capacity_));
+        h->payload_capacity = static_cast<uint32_t>(payload_capacity_);
+        h->writer_pid = static_cast<uint64_t>(getpid());
+        h->published.store(0, std::memory_order_relaxed);
+        h->state.store(shm::STATE_LIVE, std::memory_order_release);
+
+        if (rename(temp_path.c_str(), path_.c_str()) != 0) {
+            unlink(temp_path.c_str());
+            munmap(base_, size_);
+            base_ = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    // Marks the segment closed for readers still mapping it and removes it.
+    void close() {
+        if (!base_) {
+            return;
+        }
+        header()->state.store(shm::STATE_CLOSED, std::memory_order_release);
+        unlink(path_.c_str());
+        munmap(base_, size_);
+        base_ = nullptr;
+    }
+
+    const std::string& path() const {
+        return path_;
+    }
+
+    void publish(const metrics::SystemMetrics& metrics) {
+        if (!base_) {
+            return;
+        }
+
+        auto* h = header();
+        uint64_t published = h->published.load(std::memory_order_relaxed) + 1;
+        char* slot = base_ + sizeof(shm::SegmentHeader) + (published & 1) * static_cast<size_t>(h->slot_size);
+        auto* slot_header = reinterpret_cast<shm::SlotHeader*>(slot);
+
+        shm::Sample sample;
+        summarize(metrics, sample);
+        sample.sequence = published;
+
+        std::string payload = metrics.toBinary();
+        if (payload.size() <= payload_capacity_) {
+            sample.payload_size = static_cast<uint32_t>(payload.size());
+        } else {
+            sample.payload_size = 0;
+            sample.flags |= shm::FLAG_PAYLOAD_TRUNCATED;
+        }
+
+        uint64_t sequence = slot_header->sequence.load(std::memory_order_relaxed);
+        slot_header->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::memcpy(slot + shm::SAMPLE_OFFSET, &sample, sizeof(sample));
+        std::memcpy(slot + shm::PAYLOAD_OFFSET, payload.data(), sample.payload_size);
+
+        slot_header->sequence.store(sequence + 2, std::memory_order_release);
+        h->published.store(published, std::memory_order_release);
+    }
+
+private:
+    std::string path_;
+    size_t payload_capacity_;
+    char* base_ = nullptr;
+    size_t size_ = 0;
+
+    shm::SegmentHeader* header() {
+        return reinterpret_cast<shm::SegmentHeader*>(base_);
+    }
+
+    static void summarize(const metrics::SystemMetrics& metrics, shm::Sample& sample) {
+        std::memset(&sample, 0, sizeof(sample));
+
+        sample.timestamp = metrics.timestamp;
+        sample.uptime_seconds = metrics.uptime_seconds;
+        sample.cpu_usage_percent = metrics.cpu.usage_percent;
+        sample.load_1min = metrics.cpu.load_1min;
+        sample.load_5min = metrics.cpu.load_5min;
+        sample.load_15min = metrics.cpu.load_15min;
+        sample.cpu_cores = metrics.cpu.core_count;
+
+        sample.memory_total_bytes = metrics.memory.total_bytes;
+        sample.memory_used_bytes = metrics.memory.used_bytes;
+        sample.memory_available_bytes = metrics.memory.available_bytes;
+        sample.memory_cached_bytes = metrics.memory.cached_bytes;
+        sample.memory_usage_percent = metrics.memory.usage_percent;
+
+        for (const auto& disk : metrics.disks) {
+            sample.disk_max_usage_percent = std::max(sample.disk_max_usage_percent, disk.usage_percent);
+        }
+        for (const auto& net : metrics.network) {
+            sample.network_rx_bytes_per_sec += net.rx_bytes_per_sec;
+            sample.network_tx_bytes_per_sec += net.tx_bytes_per_sec;
+        }
+        for (const auto& temp : metrics.temperatures) {
+            sample.temperature_max = std::max(sample.temperature_max, temp.temperature);
+        }
+        for (const auto& container : metrics.containers) {
+            if (container.state == "running") {
+                ++sample.containers_running;
+            }
+        }
+        for (const auto& service : metrics.systemd_services) {
+            if (service.state == "failed") {
+                ++sample.services_failed;
+            }
+        }
+        sample.disk_count = static_cast<uint32_t>(metrics.disks.size());
+        sample.network_count = static_cast<uint32_t>(metrics.network.size());
+        sample.container_count = static_cast<uint32_t>(metrics.containers.size());
+
+        std::snprintf(sample.hostname, sizeof(sample.hostname), "%s", metrics.hostname.c_str());
+    }
+};
+
+}
+}
@@ -15,6 +15,7 @@ public:
     bool connect();
     void disconnect();
     bool send(const std::string& data);
+    bool sendBinary(const std::string& data);
     bool isConnected() const;
     
     void setOnMessage(std::function<void(const std::string&)> callback);
@@ -29,6 +30,7 @@ private:
     std::function<void(const std::string&)> on_message_;
     std::function<void(const std::string&)> on_error_;
     
+    bool sendFrame(unsigned char opcode, const std::string& data);
     bool performHandshake();
     std::string createHandshakeRequest();
 };
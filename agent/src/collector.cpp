@@ -25,20 +25,33 @@ void MetricsCollector::initialize() {
     // Collect system info once at initialization
     current_metrics_.system_info = SystemInfoCollector::collect();
     
-    monitors_.push_back(std::make_unique<CPUMonitor>(current_metrics_));
-    monitors_.push_back(std::make_unique<MemoryMonitor>(current_metrics_));
-    monitors_.push_back(std::make_unique<DiskMonitor>(current_metrics_));
-    monitors_.push_back(std::make_unique<SmartMonitor>(current_metrics_));
-    monitors_.push_back(std::make_unique<NetworkMonitor>(current_metrics_));
-    monitors_.push_back(std::make_unique<SystemdMonitor>(current_metrics_));
-    monitors_.push_back(std::make_unique<ContainerMonitor>(current_metrics_));
-    monitors_.push_back(std::make_unique<KubernetesMonitor>(current_metrics_));
-    monitors_.push_back(std::make_unique<TemperatureMonitor>(current_metrics_));
+    // Fast monitors only read /proc and /sys; the others run external
+    // commands.
+    auto add = [this](std::unique_ptr<Monitor> monitor, bool fast) {
+        if (fast) {
+            fast_monitors_.push_back(monitor.get());
+        }
+        monitors_.push_back(std::move(monitor));
+    };
+    add(std::make_unique<CPUMonitor>(current_metrics_), true);
+    add(std::make_unique<MemoryMonitor>(current_metrics_), true);
+    add(std::make_unique<DiskMonitor>(current_metrics_), true);
+    add(std::make_unique<SmartMonitor>(current_metrics_), false);
+    add(std::make_unique<NetworkMonitor>(current_metrics_), true);
+    add(std::make_unique<SystemdMonitor>(current_metrics_), false);
+    add(std::make_unique<ContainerMonitor>(current_metrics_), false);
+    add(std::make_unique<KubernetesMonitor>(current_metrics_), false);
+    add(std::make_unique<TemperatureMonitor>(current_metrics_), true);
 }
 
 metrics::SystemMetrics MetricsCollector::collectAll() {
     current_metrics_.timestamp = static_cast<uint64_t>(std::time(nullptr));
     
+    if (samples_collected_ > 0 && samples_collected_ % SYSTEM_INFO_REFRESH_SAMPLES == 0) {
+        current_metrics_.system_info = SystemInfoCollector::collect();
+    }
+    ++samples_collected_;
+    
     current_metrics_.disks.clear();
     current_metrics_.smart_data.clear();
     current_metrics_.network.clear();
@@ -52,5 +65,22 @@ metrics::SystemMetrics MetricsCollector::collectAll() {
     return current_metrics_;
 }
 
+metrics::SystemMetrics MetricsCollector::collectFast() {
+    current_metrics_.timestamp = static_cast<uint64_t>(std::time(nullptr));
+    
+    current_metrics_.disks.clear();
+    current_metrics_.network.clear();
+    
+    for (auto* monitor : fast_monitors_) {
+        monitor->collect();
+    }
+    
+    return current_metrics_;
+}
+
+const metrics::SystemInfo& MetricsCollector::systemInfo() const {
+    return current_metrics_.system_info;
+}
+
 }
 }
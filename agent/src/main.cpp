@@ -5,16 +5,23 @@
 #include "config.h"
 #include "local_storage.h"
 #include "http_api.h"
+#include "sample_batcher.h"
+#include "shm_publisher.h"
+#include "collect_trigger.h"
 #include "upgrade.h"
 #include <iostream>
 #include <fstream>
 #include <chrono>
 #include <thread>
 #include <csignal>
+#include <vector>
+#include <algorithm>
 #include <cstring>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pwd.h>
+#include <grp.h>
 
 using namespace blinky;
 
@@ -88,6 +95,32 @@ void writePidFile(const std::string& pid_file) {
     }
 }
 
+// User and group names or numeric ids from the config; unknown names are
+// skipped.
+std::vector<uid_t> resolveUsers(const std::vector<std::string>& names) {
+    std::vector<uid_t> uids;
+    for (const auto& name : names) {
+        if (!name.empty() && std::all_of(name.begin(), name.end(), ::isdigit)) {
+            uids.push_back(static_cast<uid_t>(std::stoul(name)));
+        } else if (struct passwd* pw = getpwnam(name.c_str())) {
+            uids.push_back(pw->pw_uid);
+        }
+    }
+    return uids;
+}
+
+std::vector<gid_t> resolveGroups(const std::vector<std::string>& names) {
+    std::vector<gid_t> gids;
+    for (const auto& name : names) {
+        if (!name.empty() && std::all_of(name.begin(), name.end(), ::isdigit)) {
+            gids.push_back(static_cast<gid_t>(std::stoul(name)));
+        } else if (struct group* gr = getgrnam(name.c_str())) {
+            gids.push_back(gr->gr_gid);
+        }
+    }
+    return gids;
+}
+
 void printUsage(const char* program) {
     std::cout << "Usage: " << program << " [options|command]\n"
               << "\n"
@@ -281,9 +314,38 @@ int main(int argc, char* argv[]) {
     std::string storage_path = config.get_string("storage.path", "/var/lib/blinky/metrics");
     size_t max_files = config.get_int("storage.max_files", 100);
     size_t max_file_size_mb = config.get_int("storage.max_file_size_mb", 10);
+    size_t max_total_size_mb = config.get_int("storage.max_total_size_mb", 1024);
+
+    agent::SyncOptions storage_sync;
+    storage_sync.policy = agent::parse_sync_policy(config.get_string("storage.sync", "none"));
+    storage_sync.interval = std::chrono::milliseconds(config.get_int("storage.sync_interval_ms", 1000));
+    storage_sync.every = config.get_int("storage.sync_every", 1);
+
+    std::vector<agent::RollupOptions> rollups = {
+        {60, static_cast<uint64_t>(config.get_int("storage.rollup_1m_retention_days", 14)) * 86400},
+        {3600, static_cast<uint64_t>(config.get_int("storage.rollup_1h_retention_days", 400)) * 86400}
+    };
+    
+    size_t cache_samples = config.get_int("storage.cache_samples", 300);
+
+    size_t batch_max_samples = config.get_int("performance.buffer_size", 100);
+    int batch_window_ms = config.get_int("performance.batch_window_ms", 0);
     
     bool api_enabled = config.get_bool("api.enabled", true);
     int api_port = config.get_int("api.port", 9092);
+    size_t api_workers = config.get_int("api.workers", 2);
+    int api_gzip_level = config.get_int("api.gzip_level", 6);
+    int api_now_min_interval_ms = config.get_int("api.now_min_interval_ms", 1000);
+    
+    agent::ListenOptions api_listen;
+    api_listen.bind_address = config.get_string("api.bind_address", "0.0.0.0");
+    api_listen.unix_socket = config.get_string("api.unix_socket", "");
+    api_listen.allowed_uids = resolveUsers(config.get_array("api.unix_socket_users"));
+    api_listen.allowed_gids = resolveGroups(config.get_array("api.unix_socket_groups"));
+    
+    bool shm_enabled = config.get_bool("shm.enabled", true);
+    std::string shm_path = config.get_string("shm.path", "/dev/shm/blinky-metrics");
+    size_t shm_payload_kb = config.get_int("shm.payload_kb", 256);
     
     bool collector_enabled = (mode == "push" || mode == "hybrid") || 
                             config.get_bool("collector.enabled", false);
@@ -304,20 +366,34 @@ int main(int argc, char* argv[]) {
     
     agent::LocalStorage* storage = nullptr;
     if (storage_enabled) {
-        storage = new agent::LocalStorage(storage_path, max_files, max_file_size_mb);
+        storage = new agent::LocalStorage(storage_path, max_files, max_file_size_mb,
+                                           max_total_size_mb, storage_sync, rollups, cache_samples);
         if (!run_as_daemon) {
             std::cout << "Local storage: " << storage_path << std::endl;
         }
     }
     
+    agent::CollectTrigger collect_trigger{std::chrono::milliseconds(api_now_min_interval_ms)};
+    
     agent::HttpApi* http_api = nullptr;
     if (http_api_enabled && storage) {
-        http_api = new agent::HttpApi(*storage, api_port);
+        http_api = new agent::HttpApi(*storage, api_port, api_workers, interval_seconds, api_gzip_level,
+                                      api_listen);
+        http_api->set_collect_now([&collect_trigger] {
+            return collect_trigger.request(std::chrono::seconds(15));
+        });
         if (http_api->start()) {
-            if (!run_as_daemon) {
+            if (!run_as_daemon && !api_listen.unix_socket.empty()) {
+                std::cout << "HTTP API listening on " << api_listen.unix_socket << std::endl;
+            }
+            if (!run_as_daemon && api_port > 0) {
                 std::cout << "HTTP API listening on port " << api_port << std::endl;
                 std::cout << "  GET http://localhost:" << api_port << "/metrics - Latest metrics" << std::endl;
+                std::cout << "  GET http://localhost:" << api_port << "/metrics/now - Collect a sample now" << std::endl;
+                std::cout << "  GET http://localhost:" << api_port << "/metrics/stream - Live metrics (Server-Sent Events)" << std::endl;
                 std::cout << "  GET http://localhost:" << api_port << "/metrics/latest?count=N - Last N metrics" << std::endl;
+                std::cout << "  GET http://localhost:" << api_port << "/metrics/range?start=T&end=T&step=S - Time range" << std::endl;
+                std::cout << "  GET http://localhost:" << api_port << "/metrics/prometheus - Prometheus exposition" << std::endl;
                 std::cout << "  GET http://localhost:" << api_port << "/health - Health check" << std::endl;
                 std::cout << "  GET http://localhost:" << api_port << "/stats - Storage stats" << std::endl;
             }
@@ -327,6 +403,19 @@ int main(int argc, char* argv[]) {
         }
     }
     
+    agent::ShmPublisher* shm_publisher = nullptr;
+    if (shm_enabled) {
+        shm_publisher = new agent::ShmPublisher(shm_path, shm_payload_kb * 1024);
+        if (shm_publisher->open()) {
+            if (!run_as_daemon) {
+                std::cout << "Shared memory: " << shm_path << std::endl;
+            }
+        } else {
+            delete shm_publisher;
+            shm_publisher = nullptr;
+        }
+    }
+    
     agent::WebSocketClient* ws_client = nullptr;
     if (collector_enabled) {
         ws_client = new agent::WebSocketClient(server_host, server_port);
@@ -340,39 +429,88 @@ int main(int argc, char* argv[]) {
         std::cout << "\nAgent is running..." << std::endl;
     }
     
+    bool session_sent = false;
+    metrics::SystemInfo session_info;
+    uint64_t sequence = 0;
+    agent::SampleBatcher batcher(batch_max_samples, std::chrono::milliseconds(batch_window_ms));
+    
+    // Samples are collected every interval, plus on demand for /metrics/now
+    // in between; on-demand samples do not move the schedule.
+    auto next_sample_at = std::chrono::steady_clock::now();
+    bool on_demand = false;
+    
     while (running) {
-        auto metrics = collector.collectAll();
+        collect_trigger.begin();
+        if (!on_demand) {
+            next_sample_at = std::chrono::steady_clock::now() + std::chrono::seconds(interval_seconds);
+        }
+        auto metrics = on_demand ? collector.collectFast() : collector.collectAll();
+        
+        if (shm_publisher) {
+            shm_publisher->publish(metrics);
+        }
         
         if (storage) {
             storage->store(metrics);
         }
         
+        if (http_api) {
+            http_api->publish_sample(metrics);
+        }
+        
+        collect_trigger.complete(metrics);
+        
         if (ws_client) {
+            batcher.add(metrics.timestamp, metrics.toBinary(false));
+            
             if (!ws_client->isConnected()) {
-                ws_client->connect();
+                if (ws_client->connect()) {
+                    session_sent = false;
+                    sequence = 0;
+                }
             }
             
-            if (ws_client->isConnected()) {
+            if (ws_client->isConnected() && 
+                (!session_sent || collector.systemInfo() != session_info)) {
                 protocol::Message msg;
-                msg.type = protocol::MessageType::METRICS;
+                msg.type = protocol::MessageType::SESSION;
                 msg.timestamp = metrics.timestamp;
                 msg.hostname = metrics.hostname;
                 msg.version = version::getVersionString();
-                msg.payload = metrics.toJSON();
+                msg.sequence = sequence++;
+                msg.flags = protocol::FLAG_BINARY_PAYLOAD;
+                msg.payload = collector.systemInfo().toBinary();
+                
+                if (ws_client->sendBinary(msg.serialize())) {
+                    session_info = collector.systemInfo();
+                    session_sent = true;
+                } else {
+                    ws_client->disconnect();
+                }
+            }
+            
+            if (ws_client->isConnected() && batcher.ready(next_sample_at)) {
+                protocol::Message msg = batcher.build(metrics.hostname, version::getVersionString());
+                msg.flags = protocol::FLAG_BINARY_PAYLOAD;
+                msg.sequence = sequence++;
                 
-                if (!ws_client->send(msg.serialize())) {
+                if (ws_client->sendBinary(msg.serialize())) {
+                    batcher.clear();
+                } else {
                     ws_client->disconnect();
                 }
             }
         }
         
-        std::this_thread::sleep_for(std::chrono::seconds(interval_seconds));
+        on_demand = collect_trigger.wait(next_sample_at);
     }
     
     if (run_as_daemon) {
         unlink(pid_file.c_str());
     }
     
+    collect_trigger.stop();
+    
     if (http_api) {
         http_api->stop();
         delete http_api;
@@ -383,6 +521,10 @@ int main(int argc, char* argv[]) {
         delete ws_client;
     }
     
+    if (shm_publisher) {
+        delete shm_publisher;
+    }
+    
     if (storage) {
         delete storage;
     }
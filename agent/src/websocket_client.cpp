@@ -100,39 +100,50 @@ void WebSocketClient::disconnect() {
 }
 
 bool WebSocketClient::send(const std::string& data) {
+    return sendFrame(0x1, data);
+}
+
+bool WebSocketClient::sendBinary(const std::string& data) {
+    return sendFrame(0x2, data);
+}
+
+bool WebSocketClient::sendFrame(unsigned char opcode, const std::string& data) {
     if (!connected_ || socket_fd_ == -1) {
         return false;
     }
     
     size_t data_len = data.length();
-    std::vector<unsigned char> frame;
+    std::string frame;
+    frame.reserve(data_len + 14);
     
-    frame.push_back(0x81);
+    frame.push_back(static_cast<char>(0x80 | opcode));
     
     if (data_len <= 125) {
-        frame.push_back(0x80 | static_cast<unsigned char>(data_len));
+        frame.push_back(static_cast<char>(0x80 | data_len));
     } else if (data_len <= 65535) {
-        frame.push_back(0x80 | 126);
-        frame.push_back((data_len >> 8) & 0xFF);
-        frame.push_back(data_len & 0xFF);
+        frame.push_back(static_cast<char>(0x80 | 126));
+        frame.push_back(static_cast<char>((data_len >> 8) & 0xFF));
+        frame.push_back(static_cast<char>(data_len & 0xFF));
     } else {
-        frame.push_back(0x80 | 127);
+        frame.push_back(static_cast<char>(0x80 | 127));
         for (int i = 7; i >= 0; --i) {
-            frame.push_back((data_len >> (i * 8)) & 0xFF);
+            frame.push_back(static_cast<char>((data_len >> (i * 8)) & 0xFF));
         }
     }
     
     unsigned char mask[4];
     for (int i = 0; i < 4; ++i) {
         mask[i] = rand() % 256;
-        frame.push_back(mask[i]);
+        frame.push_back(static_cast<char>(mask[i]));
     }
     
+    size_t payload_start = frame.size();
+    frame.append(data);
     for (size_t i = 0; i < data_len; ++i) {
-        frame.push_back(data[i] ^ mask[i % 4]);
+        frame[payload_start + i] ^= mask[i % 4];
     }
     
-    ssize_t sent = ::send(socket_fd_, frame.data(), frame.size(), 0);
+    ssize_t sent = ::send(socket_fd_, frame.data(), frame.size(), MSG_NOSIGNAL);
     if (sent < 0 || static_cast<size_t>(sent) != frame.size()) {
         connected_ = false;
         return false;
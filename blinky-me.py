@@ -11,6 +11,10 @@ import argparse
 from urllib.request import urlopen
 from urllib.error import URLError
 
+# Sections of a sample shown by display_metrics
+DISPLAYED_FIELDS = ['system_info', 'cpu', 'memory', 'disks', 'network', 'containers',
+                    'kubernetes', 'temperatures', 'smart']
+
 def clear_screen():
     """Clear terminal screen"""
     print("\033[2J\033[H", end="")
@@ -25,6 +29,13 @@ def get_metrics(url):
     except Exception as e:
         return {"error": f"Failed to fetch metrics: {e}"}
 
+def stream_metrics(url):
+    """Yield samples as the agent pushes them (Server-Sent Events)"""
+    with urlopen(url, timeout=60) as response:
+        for line in response:
+            if line.startswith(b'data: '):
+                yield json.loads(line[6:])
+
 def format_bytes(bytes_val):
     """Format bytes to human readable"""
     for unit in ['B', 'KB', 'MB', 'GB', 'TB']:
@@ -106,27 +117,27 @@ def display_metrics(data, show_all=False):
     if "cpu" in metrics:
         cpu = metrics["cpu"]
         print("\033[1;33m▶ CPU\033[0m")
-        print(f"  Usage:  {format_percent(cpu.get('usage_percent', 0))}")
-        print(f"  Load:   {cpu.get('load_1min', 0):.2f} / {cpu.get('load_5min', 0):.2f} / {cpu.get('load_15min', 0):.2f}")
-        print(f"  Cores:  {cpu.get('core_count', 0)}")
+        print(f"  Usage:  {format_percent(cpu.get('usage', 0))}")
+        print(f"  Load:   {cpu.get('load_1', 0):.2f} / {cpu.get('load_5', 0):.2f} / {cpu.get('load_15', 0):.2f}")
+        print(f"  Cores:  {cpu.get('cores', 0)}")
         print()
     
     # Memory
     if "memory" in metrics:
         mem = metrics["memory"]
         print("\033[1;35m▶ MEMORY\033[0m")
-        print(f"  Usage:  {format_percent(mem.get('usage_percent', 0))}")
-        print(f"  Used:   {format_bytes(mem.get('used_bytes', 0))} / {format_bytes(mem.get('total_bytes', 0))}")
-        print(f"  Free:   {format_bytes(mem.get('available_bytes', 0))}")
+        print(f"  Usage:  {format_percent(mem.get('usage', 0))}")
+        print(f"  Used:   {format_bytes(mem.get('used', 0))} / {format_bytes(mem.get('total', 0))}")
+        print(f"  Free:   {format_bytes(mem.get('available', 0))}")
         print()
     
     # Disks
     if "disks" in metrics and metrics["disks"]:
         print("\033[1;34m▶ DISKS\033[0m")
         for disk in metrics["disks"][:3 if not show_all else None]:
-            print(f"  {disk['mount_point']} ({disk.get('device', 'unknown')})")
-            print(f"    Usage: {format_percent(disk.get('usage_percent', 0))}")
-            print(f"    Space: {format_bytes(disk.get('used_bytes', 0))} / {format_bytes(disk.get('total_bytes', 0))}")
+            print(f"  {disk['mount']} ({disk.get('device', 'unknown')})")
+            print(f"    Usage: {format_percent(disk.get('usage', 0))}")
+            print(f"    Space: {format_bytes(disk.get('used', 0))} / {format_bytes(disk.get('total', 0))}")
             
             # Show I/O stats if available
             read_rate = disk.get('read_bytes_per_sec', 0)
@@ -220,9 +231,9 @@ def display_metrics(data, show_all=False):
     if "kubernetes" in metrics and metrics["kubernetes"].get("detected"):
         k8s = metrics["kubernetes"]
         print("\033[1;35m▶ KUBERNETES\033[0m")
-        print(f"  Type:       {k8s.get('cluster_type', 'unknown')}")
-        print(f"  Pods:       {k8s.get('pod_count', 0)}")
-        print(f"  Nodes:      {k8s.get('node_count', 0)}")
+        print(f"  Type:       {k8s.get('type', 'unknown')}")
+        print(f"  Pods:       {k8s.get('pods', 0)}")
+        print(f"  Nodes:      {k8s.get('nodes', 0)}")
         print(f"  Namespaces: {len(k8s.get('namespaces', []))}")
         if show_all and k8s.get('namespaces'):
             print(f"  Namespace list: {', '.join(k8s.get('namespaces', []))}")
@@ -263,14 +274,14 @@ def display_metrics(data, show_all=False):
         print()
     
     # SMART - Always show if there are warnings
-    if "smart_data" in metrics and metrics["smart_data"]:
-        failed = [s for s in metrics["smart_data"] if not s.get("passed", True)]
-        healthy = [s for s in metrics["smart_data"] if s.get("passed", True)]
+    if "smart" in metrics and metrics["smart"]:
+        failed = [s for s in metrics["smart"] if not s.get("passed", True)]
+        healthy = [s for s in metrics["smart"] if s.get("passed", True)]
         
         if failed:
             print("\033[1;31m▶ SMART WARNINGS\033[0m")
             for smart in failed:
-                print(f"  \033[91m✗\033[0m {smart['device']}: {smart.get('health_status', 'UNKNOWN')}")
+                print(f"  \033[91m✗\033[0m {smart['device']}: {smart.get('health', 'UNKNOWN')}")
                 if smart.get('temperature', 0) > 50:
                     print(f"    Temp: {smart['temperature']}°C")
                 if smart.get('reallocated_sectors', 0) > 0:
@@ -282,7 +293,7 @@ def display_metrics(data, show_all=False):
             for smart in healthy:
                 temp = smart.get('temperature', 0)
                 temp_color = '\033[92m' if temp < 45 else '\033[93m' if temp < 55 else '\033[91m'
-                print(f"  \033[92m✓\033[0m {smart['device']}: {smart.get('health_status', 'OK')} {temp_color}({temp}°C)\033[0m")
+                print(f"  \033[92m✓\033[0m {smart['device']}: {smart.get('health', 'OK')} {temp_color}({temp}°C)\033[0m")
             print()
     
     print("\033[90m" + "─" * 64 + "\033[0m")
@@ -302,6 +313,7 @@ Examples:
   %(prog)s host.example.com   # Remote agent by hostname
   %(prog)s 10.0.0.5 --all     # Show all details (network, containers, k8s)
   %(prog)s --interval 2       # Faster refresh (2 seconds)
+  %(prog)s --stream           # Update as soon as the agent collects a sample
         """
     )
     
@@ -316,6 +328,9 @@ Examples:
     parser.add_argument('--all', '-a',
                        action='store_true',
                        help='Show all details (network, containers, k8s)')
+    parser.add_argument('--stream', '-s',
+                       action='store_true',
+                       help='Receive samples from the agent as they are collected instead of polling')
     
     args = parser.parse_args()
     
@@ -326,11 +341,25 @@ Examples:
     else:
         url = host if '/metrics' in host else f'{host}/metrics'
     
+    if args.stream and url.endswith('/metrics'):
+        url += '/stream'
+    
+    # Only ask for the sections displayed below
+    if 'fields=' not in url:
+        url += ('&' if '?' in url else '?') + 'fields=' + ','.join(DISPLAYED_FIELDS)
+    
     try:
         print("\033[?25l", end="")  # Hide cursor
         while True:
-            data = get_metrics(url)
-            display_metrics(data, args.all)
+            if '/metrics/stream' in url:
+                try:
+                    for data in stream_metrics(url):
+                        display_metrics(data, args.all)
+                except (URLError, OSError, ValueError) as e:
+                    display_metrics({"error": str(e)}, args.all)
+            else:
+                data = get_metrics(url)
+                display_metrics(data, args.all)
             time.sleep(args.interval)
     except KeyboardInterrupt:
         print("\033[?25h")  # Show cursor
@@ -2,6 +2,7 @@
 #define BLINKY_COLLECTOR_HTTP_SERVER_H
 
 #include "metrics_store.h"
+#include "cached_buffer.h"
 #include <string>
 #include <thread>
 #include <atomic>
@@ -11,18 +12,27 @@ namespace collector {
 
 class HttpServer {
 public:
-    HttpServer(int port, MetricsStore& store);
+    // gzip_level is the zlib level (1-9) for clients accepting gzip; 0
+    // turns compression off.
+    HttpServer(int port, MetricsStore& store, int gzip_level = 6);
     ~HttpServer();
     
     bool start();
     void stop();
     bool isRunning() const;
     
+    // Re-renders the fleet-wide Prometheus exposition if the store changed
+    // since the last call. Called once per collector tick.
+    void refreshPrometheus();
+    
 private:
     int port_;
     int server_fd_;
     std::atomic<bool> running_;
     MetricsStore& store_;
+    int gzip_level_;
+    CachedBuffer prometheus_;
+    uint64_t prometheus_generation_ = 0;
     
     std::thread accept_thread_;
     
@@ -32,7 +42,7 @@ private:
     std::string handleRequest(const std::string& request);
     std::string generateDashboard();
     std::string generateHostDetails(const std::string& hostname);
-    std::string generateAPIResponse();
+    std::string generateAPIResponse(const std::string& target, bool gzip);
 };
 
 }
@@ -13,11 +13,12 @@ namespace collector {
 struct HostMetricsHistory {
     std::string hostname;
     std::string agent_version;
+    metrics::SystemInfo system_info;
     metrics::SystemMetrics latest;
     std::deque<metrics::SystemMetrics> history;
-    uint64_t last_update;
-    bool online;
-    bool version_mismatch;
+    uint64_t last_update = 0;
+    bool online = false;
+    bool version_mismatch = false;
     
     static const size_t MAX_HISTORY = 1000;
 };
@@ -28,6 +29,10 @@ public:
     ~MetricsStore();
     
     void storeMetrics(const metrics::SystemMetrics& metrics, const std::string& agent_version);
+    void storeMetricsBatch(const std::vector<metrics::SystemMetrics>& batch,
+                           const std::string& agent_version);
+    void storeSystemInfo(const std::string& hostname, const metrics::SystemInfo& info,
+                         const std::string& agent_version);
     
     HostMetricsHistory getHostMetrics(const std::string& hostname) const;
     std::vector<std::string> getHostnames() const;
@@ -38,8 +43,18 @@ public:
     
     size_t getHostCount() const;
     
+    // Latest sample of every host with its session inventory filled in.
+    std::vector<metrics::SystemMetrics> getLatestSnapshots() const;
+    
+    // Incremented on every ingest, so renderers can skip unchanged ticks.
+    uint64_t getGeneration() const;
+    
 private:
     std::map<std::string, HostMetricsHistory> hosts_;
+    std::map<std::string, metrics::SystemInfo> pending_system_info_;
+    uint64_t generation_ = 0;
+    
+    void storeLocked(const metrics::SystemMetrics& metrics, const std::string& agent_version);
     mutable std::mutex mutex_;
 };
 
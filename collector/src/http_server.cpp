@@ -1,4 +1,6 @@
 #include "http_server.h"
+#include "metrics_schema.h"
+#include "http_encoding.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <unistd.h>
@@ -6,12 +8,16 @@
 #include <iostream>
 #include <sstream>
 #include <iomanip>
+#include <memory>
+#include <algorithm>
+#include <cctype>
 
 namespace blinky {
 namespace collector {
 
-HttpServer::HttpServer(int port, MetricsStore& store)
-    : port_(port), server_fd_(-1), running_(false), store_(store) {
+HttpServer::HttpServer(int port, MetricsStore& store, int gzip_level)
+    : port_(port), server_fd_(-1), running_(false), store_(store),
+      gzip_level_(std::min(std::max(gzip_level, 0), 9)) {
 }
 
 HttpServer::~HttpServer() {
@@ -107,13 +113,39 @@ void HttpServer::handleClient(int client_fd) {
     close(client_fd);
 }
 
+// Value of a request header, matched case-insensitively; empty if absent.
+static std::string getHeader(const std::string& request, const std::string& name) {
+    std::istringstream iss(request);
+    std::string line;
+    std::getline(iss, line);
+    while (std::getline(iss, line) && line != "\r") {
+        size_t colon = line.find(':');
+        if (colon != name.size() ||
+            !std::equal(name.begin(), name.end(), line.begin(),
+                        [](char a, char b) { return std::tolower(a) == std::tolower(b); })) {
+            continue;
+        }
+        size_t start = line.find_first_not_of(" \t", colon + 1);
+        size_t end = line.find_last_not_of(" \t\r");
+        return start == std::string::npos || end < start ? "" : line.substr(start, end - start + 1);
+    }
+    return "";
+}
+
 std::string HttpServer::handleRequest(const std::string& request) {
     std::istringstream iss(request);
     std::string method, path, version;
     iss >> method >> path >> version;
     
+    std::string target = path;
+    path = path.substr(0, path.find('?'));
+    
+    bool gzip = gzip_level_ > 0 && http::acceptsGzip(getHeader(request, "accept-encoding"));
+    bool encoded = false;
+    
     std::string content;
     std::string content_type = "text/html";
+    std::string status = "200 OK";
     
     if (path == "/" || path == "/dashboard") {
         content = generateDashboard();
@@ -121,16 +153,43 @@ std::string HttpServer::handleRequest(const std::string& request) {
         std::string hostname = path.substr(6);
         content = generateHostDetails(hostname);
     } else if (path == "/api/metrics") {
-        content = generateAPIResponse();
+        content = generateAPIResponse(target, gzip);
+        encoded = gzip;
         content_type = "application/json";
+    } else if (path == "/api/prometheus") {
+        // Compressed once per update and shared by all scrapes
+        uint64_t generation = 0;
+        auto text = gzip ? prometheus_.getCompressed(gzip_level_, generation) : prometheus_.get();
+        if (text) {
+            content = *text;
+            encoded = gzip;
+            content_type = "text/plain; version=0.0.4; charset=utf-8";
+        } else {
+            // Not rendered yet: an empty 200 would look like a healthy
+            // target with no series
+            status = "503 Service Unavailable";
+            content = "No sample collected yet";
+            content_type = "text/plain";
+        }
     } else {
         content = "<html><body><h1>404 Not Found</h1></body></html>";
     }
     
+    if (gzip && !encoded && content.size() >= http::MIN_COMPRESS_SIZE) {
+        content = http::gzipCompress(content, gzip_level_);
+        encoded = true;
+    }
+    
     std::ostringstream response;
-    response << "HTTP/1.1 200 OK\r\n";
+    response << "HTTP/1.1 " << status << "\r\n";
     response << "Content-Type: " << content_type << "\r\n";
     response << "Content-Length: " << content.length() << "\r\n";
+    if (encoded) {
+        response << "Content-Encoding: gzip\r\n";
+    }
+    if (gzip_level_ > 0) {
+        response << "Vary: Accept-Encoding\r\n";
+    }
     response << "Connection: close\r\n";
     response << "\r\n";
     response << content;
@@ -138,6 +197,28 @@ std::string HttpServer::handleRequest(const std::string& request) {
     return response.str();
 }
 
+void HttpServer::refreshPrometheus() {
+    uint64_t generation = store_.getGeneration();
+    if (generation == prometheus_generation_ && prometheus_.get()) {
+        return;
+    }
+    
+    auto snapshots = store_.getLatestSnapshots();
+    if (snapshots.empty() && !prometheus_.get()) {
+        return;  // /api/prometheus answers 503 until a host has reported
+    }
+    std::vector<const metrics::SystemMetrics*> samples;
+    samples.reserve(snapshots.size());
+    for (const auto& snapshot : snapshots) {
+        samples.push_back(&snapshot);
+    }
+    
+    std::string text;
+    metrics::schema::writePrometheus(text, samples);
+    prometheus_.publish(std::move(text));
+    prometheus_generation_ = generation;
+}
+
 std::string HttpServer::generateDashboard() {
     std::ostringstream html;
     
@@ -260,30 +341,73 @@ std::string HttpServer::generateHostDetails(const std::string& hostname) {
     return html.str();
 }
 
-std::string HttpServer::generateAPIResponse() {
-    std::ostringstream json;
-    json << "{\"hosts\":[";
+// The target's query may hold a projection (fields=..., label filters), see
+// metrics::schema::parseProjection. Hosts whose hostname does not match a
+// hostname filter are left out.
+std::string HttpServer::generateAPIResponse(const std::string& target, bool gzip) {
+    auto projection = metrics::schema::parseProjection(target);
+    const auto& root = projection.root;
+    auto system_info = root.children.find("system_info");
+    
+    // With gzip the document is compressed host by host as it is written,
+    // so only its compressed form is held whole.
+    std::string out;
+    std::unique_ptr<http::GzipEncoder> encoder;
+    if (gzip) {
+        encoder = std::make_unique<http::GzipEncoder>(gzip_level_);
+    }
+    auto emit = [&](const std::string& piece) {
+        if (encoder) {
+            encoder->write(piece, out);
+        } else {
+            out += piece;
+        }
+    };
+    
+    emit("{\"hosts\":[");
     
     auto hosts = store_.getAllHosts();
     bool first = true;
     
     for (const auto& pair : hosts) {
+        const auto& host = pair.second;
+        
+        std::string metrics_json;
+        metrics_json.reserve(4096);
+        if (!metrics::schema::writeProjectedJSON(metrics_json, host.latest, projection, false)) {
+            continue;
+        }
+        
+        std::ostringstream json;
         if (!first) json << ",";
         first = false;
         
-        const auto& host = pair.second;
         json << "{";
         json << "\"hostname\":\"" << host.hostname << "\",";
         json << "\"agent_version\":\"" << host.agent_version << "\",";
         json << "\"online\":" << (host.online ? "true" : "false") << ",";
         json << "\"version_mismatch\":" << (host.version_mismatch ? "true" : "false") << ",";
-        json << "\"metrics\":" << host.latest.toJSON();
+        
+        // Samples no longer carry the host inventory; splice the per-host
+        // copy from the session message back into the metrics object.
+        if (root.all || system_info != root.children.end()) {
+            metrics_json.pop_back();
+            metrics_json += ",\"system_info\":";
+            metrics::schema::writeJSON(metrics_json, host.system_info, metrics::schema::WriteOptions(),
+                root.all || system_info->second.all ? nullptr : &system_info->second);
+            metrics_json += "}";
+        }
+        json << "\"metrics\":" << metrics_json;
         json << "}";
+        emit(json.str());
     }
     
-    json << "]}";
+    emit("]}");
+    if (encoder) {
+        encoder->finish(out);
+    }
     
-    return json.str();
+    return out;
 }
 
 }
@@ -25,12 +25,14 @@ void printUsage(const char* program) {
               << "  -v, --version           Show version information\n"
               << "  -w, --ws-port PORT      WebSocket port (default: 9090)\n"
               << "  -p, --http-port PORT    HTTP dashboard port (default: 9091)\n"
+              << "  -z, --gzip-level LEVEL  gzip level 1-9 for HTTP responses, 0 = off (default: 6)\n"
               << std::endl;
 }
 
 int main(int argc, char* argv[]) {
     int ws_port = 9090;
     int http_port = 9091;
+    int gzip_level = 6;
     
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -44,6 +46,8 @@ int main(int argc, char* argv[]) {
             ws_port = std::atoi(argv[++i]);
         } else if ((arg == "-p" || arg == "--http-port") && i + 1 < argc) {
             http_port = std::atoi(argv[++i]);
+        } else if ((arg == "-z" || arg == "--gzip-level") && i + 1 < argc) {
+            gzip_level = std::atoi(argv[++i]);
         } else {
             std::cerr << "Unknown option: " << arg << std::endl;
             printUsage(argv[0]);
@@ -60,22 +64,61 @@ int main(int argc, char* argv[]) {
     
     collector::MetricsStore store;
     collector::WebSocketServer ws_server(ws_port);
-    collector::HttpServer http_server(http_port, store);
+    collector::HttpServer http_server(http_port, store, gzip_level);
     
     ws_server.setOnMessage([&store](const collector::Client& client, const std::string& data) {
         try {
-            protocol::Message msg = protocol::Message::deserialize(data);
+            protocol::MessageView msg;
+            if (!protocol::MessageView::decode(data, msg)) {
+                std::cerr << "Dropping malformed message frame from " << client.hostname
+                          << " (agents using the old text protocol must be upgraded)" << std::endl;
+                return;
+            }
+            
+            std::string hostname(msg.hostname);
+            std::string agent_version(msg.version);
+            bool binary = (msg.flags & protocol::FLAG_BINARY_PAYLOAD) != 0;
+            auto decode_sample = [binary](std::string_view payload) {
+                return binary ? metrics::SystemMetrics::fromBinary(payload)
+                              : metrics::SystemMetrics::fromJSON(payload);
+            };
             
             if (msg.type == protocol::MessageType::METRICS) {
-                metrics::SystemMetrics metrics = metrics::SystemMetrics::fromJSON(msg.payload);
-                metrics.hostname = msg.hostname;
+                metrics::SystemMetrics metrics = decode_sample(msg.payload);
+                metrics.hostname = hostname;
                 metrics.timestamp = msg.timestamp;
                 
-                store.storeMetrics(metrics, msg.version);
+                store.storeMetrics(metrics, agent_version);
                 
-                std::cout << "Received metrics from " << msg.hostname 
-                          << " v" << msg.version
+                std::cout << "Received metrics from " << hostname 
+                          << " v" << agent_version
                           << " (CPU: " << metrics.cpu.usage_percent << "%)" << std::endl;
+            } else if (msg.type == protocol::MessageType::METRICS_BATCH) {
+                std::vector<protocol::BatchEntry> entries;
+                if (!protocol::decodeBatch(msg.payload, entries)) {
+                    std::cerr << "Dropping malformed batch from " << hostname << std::endl;
+                    return;
+                }
+                
+                std::vector<metrics::SystemMetrics> batch;
+                batch.reserve(entries.size());
+                for (const auto& entry : entries) {
+                    batch.push_back(decode_sample(entry.payload));
+                    batch.back().hostname = hostname;
+                    batch.back().timestamp = entry.timestamp;
+                }
+                
+                store.storeMetricsBatch(batch, agent_version);
+                
+                std::cout << "Received " << batch.size() << " samples from " << hostname 
+                          << " v" << agent_version << std::endl;
+            } else if (msg.type == protocol::MessageType::SESSION) {
+                metrics::SystemInfo info = binary ? metrics::SystemInfo::fromBinary(msg.payload)
+                                                  : metrics::SystemInfo::fromJSON(msg.payload);
+                store.storeSystemInfo(hostname, info, agent_version);
+                
+                std::cout << "Session started for " << hostname 
+                          << " v" << agent_version << std::endl;
             }
         } catch (const std::exception& e) {
             std::cerr << "Error processing message: " << e.what() << std::endl;
@@ -104,12 +147,14 @@ int main(int argc, char* argv[]) {
     
     std::cout << "\nCollector is running..." << std::endl;
     std::cout << "Dashboard available at: http://localhost:" << http_port << "/" << std::endl;
+    std::cout << "Prometheus metrics at: http://localhost:" << http_port << "/api/prometheus" << std::endl;
     std::cout << "Press Ctrl+C to stop\n" << std::endl;
     
     while (running) {
         std::this_thread::sleep_for(std::chrono::seconds(1));
         
         store.cleanupOldData(3600);
+        http_server.refreshPrometheus();
     }
     
     std::cout << "\nShutting down collector..." << std::endl;
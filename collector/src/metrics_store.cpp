@@ -14,8 +14,27 @@ MetricsStore::~MetricsStore() {
 
 void MetricsStore::storeMetrics(const metrics::SystemMetrics& metrics, const std::string& agent_version) {
     std::lock_guard<std::mutex> lock(mutex_);
+    storeLocked(metrics, agent_version);
+}
+
+void MetricsStore::storeMetricsBatch(const std::vector<metrics::SystemMetrics>& batch,
+                                     const std::string& agent_version) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    for (const auto& metrics : batch) {
+        storeLocked(metrics, agent_version);
+    }
+}
+
+void MetricsStore::storeLocked(const metrics::SystemMetrics& metrics, const std::string& agent_version) {
+    ++generation_;
     
     auto& host = hosts_[metrics.hostname];
+    auto pending = pending_system_info_.find(metrics.hostname);
+    if (pending != pending_system_info_.end()) {
+        host.system_info = std::move(pending->second);
+        pending_system_info_.erase(pending);
+    }
     host.hostname = metrics.hostname;
     host.agent_version = agent_version;
     host.latest = metrics;
@@ -26,13 +45,38 @@ void MetricsStore::storeMetrics(const metrics::SystemMetrics& metrics, const std
     version::Version agent_ver = version::Version::fromString(agent_version);
     host.version_mismatch = !collector_ver.isCompatible(agent_ver);
     
-    host.history.push_back(metrics);
+    // The inventory normally arrives in SESSION messages. If a sample
+    // carries it anyway, keep it once per host and drop it from the
+    // retained samples.
+    if (!metrics.system_info.hostname.empty()) {
+        host.system_info = metrics.system_info;
+        host.latest.system_info = metrics::SystemInfo();
+    }
+    
+    host.history.push_back(host.latest);
     
     if (host.history.size() > HostMetricsHistory::MAX_HISTORY) {
         host.history.pop_front();
     }
 }
 
+void MetricsStore::storeSystemInfo(const std::string& hostname, const metrics::SystemInfo& info,
+                                   const std::string& agent_version) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    // A host is only listed once it has sent a sample; until then its
+    // inventory waits here.
+    auto it = hosts_.find(hostname);
+    if (it == hosts_.end()) {
+        pending_system_info_[hostname] = info;
+        return;
+    }
+    
+    it->second.agent_version = agent_version;
+    it->second.system_info = info;
+    ++generation_;
+}
+
 HostMetricsHistory MetricsStore::getHostMetrics(const std::string& hostname) const {
     std::lock_guard<std::mutex> lock(mutex_);
     
@@ -96,5 +140,24 @@ size_t MetricsStore::getHostCount() const {
     return hosts_.size();
 }
 
+std::vector<metrics::SystemMetrics> MetricsStore::getLatestSnapshots() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    
+    std::vector<metrics::SystemMetrics> snapshots;
+    snapshots.reserve(hosts_.size());
+    for (const auto& pair : hosts_) {
+        snapshots.push_back(pair.second.latest);
+        snapshots.back().hostname = pair.first;
+        snapshots.back().system_info = pair.second.system_info;
+    }
+    
+    return snapshots;
+}
+
+uint64_t MetricsStore::getGeneration() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return generation_;
+}
+
 }
 }
@@ -276,11 +276,13 @@ std::string WebSocketServer::receiveFrame(int client_fd) {
         }
     }
     
-    std::vector<unsigned char> payload(payload_len);
+    // Receive straight into the returned buffer; protocol::MessageView
+    // decodes in place from here on.
+    std::string payload(payload_len, '\0');
     size_t total_received = 0;
     
     while (total_received < payload_len) {
-        ssize_t n = recv(client_fd, payload.data() + total_received, payload_len - total_received, 0);
+        ssize_t n = recv(client_fd, &payload[total_received], payload_len - total_received, 0);
         if (n <= 0) {
             return "";
         }
@@ -293,7 +295,7 @@ std::string WebSocketServer::receiveFrame(int client_fd) {
         }
     }
     
-    return std::string(payload.begin(), payload.end());
+    return payload;
 }
 
 void WebSocketServer::removeClient(int client_fd) {
@@ -86,7 +86,7 @@ install_from_source() {
     
     echo "Installing build dependencies..."
     apt-get update -qq
-    apt-get install -y build-essential cmake libssl-dev git
+    apt-get install -y build-essential cmake libssl-dev zlib1g-dev git
     
     echo ""
     echo "Cloning repository..."
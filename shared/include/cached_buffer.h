@@ -0,0 +1,69 @@
+#ifndef BLINKY_CACHED_BUFFER_H
+#define BLINKY_CACHED_BUFFER_H
+
+#include "http_encoding.h"
+#include <string>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+namespace blinky {
+
+// Holds the most recently rendered response body. Writers publish a new
+// buffer once per update; readers share the immutable buffer by reference
+// count, so serving it never re-renders or copies under the lock. A gzip
+// copy is made on first request after each publish and shared the same way.
+class CachedBuffer {
+public:
+    void publish(std::string body) {
+        auto buffer = std::make_shared<const std::string>(std::move(body));
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffer_ = std::move(buffer);
+        ++generation_;
+    }
+
+    std::shared_ptr<const std::string> get() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return buffer_;
+    }
+
+    // The buffer together with the generation that published it.
+    std::shared_ptr<const std::string> get(uint64_t& generation) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        generation = generation_;
+        return buffer_;
+    }
+
+    // The current buffer gzip-compressed at level, with its generation.
+    // Concurrent first requests wait for a single compression.
+    std::shared_ptr<const std::string> getCompressed(int level, uint64_t& generation) const {
+        std::lock_guard<std::mutex> lock(compress_mutex_);
+        auto buffer = get(generation);
+        if (!buffer) {
+            return nullptr;
+        }
+        if (!compressed_ || compressed_generation_ != generation) {
+            compressed_ = std::make_shared<const std::string>(http::gzipCompress(*buffer, level));
+            compressed_generation_ = generation;
+        }
+        return compressed_;
+    }
+
+    uint64_t generation() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return generation_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::shared_ptr<const std::string> buffer_;
+    uint64_t generation_ = 0;
+
+    mutable std::mutex compress_mutex_;
+    mutable std::shared_ptr<const std::string> compressed_;
+    mutable uint64_t compressed_generation_ = 0;
+};
+
+}
+
+#endif
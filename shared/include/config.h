@@ -143,10 +143,25 @@ public:
         values["storage.path"] = "/var/lib/blinky/metrics";
         values["storage.max_files"] = "100";
         values["storage.max_file_size_mb"] = "10";
+        values["storage.max_total_size_mb"] = "1024";
+        values["storage.sync"] = "none";
+        values["storage.sync_interval_ms"] = "1000";
+        values["storage.sync_every"] = "1";
+        values["storage.rollup_1m_retention_days"] = "14";
+        values["storage.rollup_1h_retention_days"] = "400";
+        values["storage.cache_samples"] = "300";
         
         values["api.enabled"] = "true";
         values["api.port"] = "9092";
         values["api.bind_address"] = "0.0.0.0";
+        values["api.workers"] = "2";
+        values["api.gzip_level"] = "6";
+        values["api.unix_socket"] = "";
+        values["api.now_min_interval_ms"] = "1000";
+        
+        values["shm.enabled"] = "true";
+        values["shm.path"] = "/dev/shm/blinky-metrics";
+        values["shm.payload_kb"] = "256";
         
         values["collector.enabled"] = "false";
         values["collector.host"] = "localhost";
@@ -187,6 +202,7 @@ public:
         values["security.verify_cert"] = "true";
         
         values["performance.buffer_size"] = "100";
+        values["performance.batch_window_ms"] = "0";
         values["performance.worker_threads"] = "4";
         values["performance.compression"] = "false";
         values["performance.aggregation_window"] = "0";
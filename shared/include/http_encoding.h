@@ -0,0 +1,126 @@
+#ifndef BLINKY_HTTP_ENCODING_H
+#define BLINKY_HTTP_ENCODING_H
+
+#include <string>
+#include <string_view>
+#include <cstdlib>
+#include <cctype>
+#include <zlib.h>
+
+namespace blinky {
+namespace http {
+
+// Bodies smaller than this are sent as they are; compressing them saves
+// less than the gzip framing costs.
+constexpr size_t MIN_COMPRESS_SIZE = 1024;
+
+// True if an Accept-Encoding header value allows gzip. Every entry is
+// looked at: gzip or x-gzip listed with a non-zero q allows it, and only
+// if neither is listed does a * entry decide.
+inline bool acceptsGzip(std::string_view header) {
+    double explicit_quality = -1.0;
+    double wildcard_quality = -1.0;
+    while (!header.empty()) {
+        size_t comma = header.find(',');
+        std::string_view item = header.substr(0, comma);
+        header = comma == std::string_view::npos ? std::string_view() : header.substr(comma + 1);
+
+        size_t semicolon = item.find(';');
+        std::string_view name = item.substr(0, semicolon);
+        while (!name.empty() && std::isspace(static_cast<unsigned char>(name.front()))) name.remove_prefix(1);
+        while (!name.empty() && std::isspace(static_cast<unsigned char>(name.back()))) name.remove_suffix(1);
+
+        std::string lower;
+        for (char c : name) {
+            lower.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+        }
+        bool wildcard = lower == "*";
+        if (lower != "gzip" && lower != "x-gzip" && !wildcard) {
+            continue;
+        }
+
+        double quality = 1.0;
+        if (semicolon != std::string_view::npos) {
+            std::string params(item.substr(semicolon + 1));
+            size_t q = params.find("q=");
+            if (q != std::string::npos) {
+                quality = std::strtod(params.c_str() + q + 2, nullptr);
+            }
+        }
+        double& best = wildcard ? wildcard_quality : explicit_quality;
+        if (quality > best) {
+            best = quality;
+        }
+    }
+    return explicit_quality >= 0.0 ? explicit_quality > 0.0 : wildcard_quality > 0.0;
+}
+
+// Incremental gzip compressor: a body can be compressed piece by piece as
+// it is produced, without holding all of it.
+class GzipEncoder {
+public:
+    explicit GzipEncoder(int level) {
+        ok_ = deflateInit2(&stream_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+
+    ~GzipEncoder() {
+        if (ok_) {
+            deflateEnd(&stream_);
+        }
+    }
+
+    GzipEncoder(const GzipEncoder&) = delete;
+    GzipEncoder& operator=(const GzipEncoder&) = delete;
+
+    // Appends to out whatever compressed output the input completes.
+    bool write(std::string_view in, std::string& out) {
+        return run(in, Z_NO_FLUSH, out);
+    }
+
+    // Appends the rest of the compressed stream and its trailer.
+    bool finish(std::string& out) {
+        return run(std::string_view(), Z_FINISH, out);
+    }
+
+private:
+    z_stream stream_{};
+    bool ok_ = false;
+
+    bool run(std::string_view in, int flush, std::string& out) {
+        if (!ok_) {
+            return false;
+        }
+
+        stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+        stream_.avail_in = static_cast<uInt>(in.size());
+
+        char buffer[16384];
+        int result;
+        do {
+            stream_.next_out = reinterpret_cast<Bytef*>(buffer);
+            stream_.avail_out = sizeof(buffer);
+            result = deflate(&stream_, flush);
+            if (result == Z_STREAM_ERROR) {
+                ok_ = false;
+                return false;
+            }
+            out.append(buffer, sizeof(buffer) - stream_.avail_out);
+        } while (stream_.avail_out == 0 || (flush == Z_FINISH && result != Z_STREAM_END));
+
+        return true;
+    }
+};
+
+inline std::string gzipCompress(std::string_view data, int level) {
+    std::string out;
+    out.reserve(data.size() / 4 + 64);
+    GzipEncoder encoder(level);
+    encoder.write(data, out);
+    encoder.finish(out);
+    return out;
+}
+
+}
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define BLINKY_METRICS_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
 #include <cstdint>
@@ -19,31 +20,39 @@ struct SystemInfo {
     uint32_t cpu_cores = 0;
     uint32_t cpu_threads = 0;
     uint64_t total_memory_bytes = 0;
+    
+    bool operator==(const SystemInfo& other) const;
+    bool operator!=(const SystemInfo& other) const { return !(*this == other); }
+    
+    std::string toJSON() const;
+    static SystemInfo fromJSON(std::string_view json);
+    std::string toBinary() const;
+    static SystemInfo fromBinary(std::string_view data);
 };
 
 struct CPUMetrics {
-    double usage_percent;
-    double load_1min;
-    double load_5min;
-    double load_15min;
-    uint32_t core_count;
+    double usage_percent = 0.0;
+    double load_1min = 0.0;
+    double load_5min = 0.0;
+    double load_15min = 0.0;
+    uint32_t core_count = 0;
 };
 
 struct MemoryMetrics {
-    uint64_t total_bytes;
-    uint64_t used_bytes;
-    uint64_t available_bytes;
-    uint64_t cached_bytes;
-    double usage_percent;
+    uint64_t total_bytes = 0;
+    uint64_t used_bytes = 0;
+    uint64_t available_bytes = 0;
+    uint64_t cached_bytes = 0;
+    double usage_percent = 0.0;
 };
 
 struct DiskMetrics {
     std::string device;
     std::string mount_point;
-    uint64_t total_bytes;
-    uint64_t used_bytes;
-    uint64_t available_bytes;
-    double usage_percent;
+    uint64_t total_bytes = 0;
+    uint64_t used_bytes = 0;
+    uint64_t available_bytes = 0;
+    double usage_percent = 0.0;
     uint64_t read_bytes = 0;
     uint64_t write_bytes = 0;
     uint64_t read_ops = 0;
@@ -56,22 +65,22 @@ struct DiskMetrics {
 
 struct SmartMetrics {
     std::string device;
-    int temperature;
-    uint64_t power_on_hours;
-    uint64_t reallocated_sectors;
-    uint64_t pending_sectors;
+    int temperature = 0;
+    uint64_t power_on_hours = 0;
+    uint64_t reallocated_sectors = 0;
+    uint64_t pending_sectors = 0;
     std::string health_status;
-    bool passed;
+    bool passed = false;
 };
 
 struct NetworkMetrics {
     std::string interface;
-    uint64_t rx_bytes;
-    uint64_t tx_bytes;
-    uint64_t rx_packets;
-    uint64_t tx_packets;
-    uint64_t rx_errors;
-    uint64_t tx_errors;
+    uint64_t rx_bytes = 0;
+    uint64_t tx_bytes = 0;
+    uint64_t rx_packets = 0;
+    uint64_t tx_packets = 0;
+    uint64_t rx_errors = 0;
+    uint64_t tx_errors = 0;
     double rx_bytes_per_sec = 0.0;
     double tx_bytes_per_sec = 0.0;
     double rx_packets_per_sec = 0.0;
@@ -82,8 +91,8 @@ struct SystemdServiceMetrics {
     std::string name;
     std::string state;
     std::string sub_state;
-    bool active;
-    bool enabled;
+    bool active = false;
+    bool enabled = false;
 };
 
 struct ContainerMetrics {
@@ -116,9 +125,9 @@ struct ContainerMetrics {
 
 struct KubernetesMetrics {
     std::string cluster_type;
-    bool detected;
-    int pod_count;
-    int node_count;
+    bool detected = false;
+    int pod_count = 0;
+    int node_count = 0;
     std::vector<std::string> namespaces;
 };
 
@@ -132,9 +141,9 @@ struct TemperatureMetrics {
 };
 
 struct SystemMetrics {
-    uint64_t timestamp;
+    uint64_t timestamp = 0;
     std::string hostname;
-    uint64_t uptime_seconds;
+    uint64_t uptime_seconds = 0;
     
     SystemInfo system_info;
     CPUMetrics cpu;
@@ -147,8 +156,13 @@ struct SystemMetrics {
     KubernetesMetrics kubernetes;
     std::vector<TemperatureMetrics> temperatures;
     
-    std::string toJSON() const;
-    static SystemMetrics fromJSON(const std::string& json);
+    // Field layout for all encodings lives in metrics_schema.h. Static host
+    // inventory is sent once per session (MessageType::SESSION), so
+    // per-sample payloads pushed to the collector leave it out.
+    std::string toJSON(bool include_system_info = true) const;
+    static SystemMetrics fromJSON(std::string_view json);
+    std::string toBinary(bool include_system_info = true) const;
+    static SystemMetrics fromBinary(std::string_view data);
 };
 
 }
@@ -0,0 +1,1361 @@
+#ifndef BLINKY_METRICS_SCHEMA_H
+#define BLINKY_METRICS_SCHEMA_H
+
+#include "metrics.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <functional>
+#include <algorithm>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <charconv>
+#include <cstring>
+#include <cmath>
+
+namespace blinky {
+namespace metrics {
+namespace schema {
+
+// Compile-time description of every struct in metrics.h. The JSON writer and
+// parser, the binary codec and the Prometheus exposition below are all
+// generated from these tables, so a new field only has to be added here.
+
+enum class Unit : uint8_t {
+    None,
+    Percent,
+    Bytes,
+    BytesPerSecond,
+    PerSecond,
+    Seconds,
+    Hours,
+    Celsius
+};
+
+enum Flags : uint8_t {
+    NONE = 0,
+    OMIT_IF_ZERO = 1 << 0,  // JSON: leave the field out when it is zero
+    SESSION = 1 << 1,       // host inventory, sent once per session
+    LABEL = 1 << 2,         // identifies the record; Prometheus label
+    INFO = 1 << 3,          // Prometheus label on the <prefix>_info series
+    COUNTER = 1 << 4        // monotonically increasing counter
+};
+
+template <typename Class, typename T>
+struct Field {
+    using value_type = T;
+
+    const char* name;
+    T Class::*member;
+    Unit unit;
+    uint8_t flags;
+};
+
+template <typename Class, typename T>
+constexpr Field<Class, T> field(const char* name, T Class::*member,
+                                Unit unit = Unit::None, uint8_t flags = NONE) {
+    return Field<Class, T>{name, member, unit, flags};
+}
+
+template <typename T>
+struct Schema;
+
+template <>
+struct Schema<SystemInfo> {
+    static constexpr const char* prefix = "system";
+    static constexpr auto fields = std::make_tuple(
+        field("hostname", &SystemInfo::hostname),
+        field("os_name", &SystemInfo::os_name, Unit::None, INFO),
+        field("os_version", &SystemInfo::os_version, Unit::None, INFO),
+        field("kernel", &SystemInfo::kernel_version, Unit::None, INFO),
+        field("architecture", &SystemInfo::architecture, Unit::None, INFO),
+        field("cpu_model", &SystemInfo::cpu_model, Unit::None, INFO),
+        field("cpu_cores", &SystemInfo::cpu_cores),
+        field("cpu_threads", &SystemInfo::cpu_threads),
+        field("total_memory", &SystemInfo::total_memory_bytes, Unit::Bytes)
+    );
+};
+
+template <>
+struct Schema<CPUMetrics> {
+    static constexpr const char* prefix = "cpu";
+    static constexpr auto fields = std::make_tuple(
+        field("usage", &CPUMetrics::usage_percent, Unit::Percent),
+        field("load_1", &CPUMetrics::load_1min),
+        field("load_5", &CPUMetrics::load_5min),
+        field("load_15", &CPUMetrics::load_15min),
+        field("cores", &CPUMetrics::core_count)
+    );
+};
+
+template <>
+struct Schema<MemoryMetrics> {
+    static constexpr const char* prefix = "memory";
+    static constexpr auto fields = std::make_tuple(
+        field("total", &MemoryMetrics::total_bytes, Unit::Bytes),
+        field("used", &MemoryMetrics::used_bytes, Unit::Bytes),
+        field("available", &MemoryMetrics::available_bytes, Unit::Bytes),
+        field("cached", &MemoryMetrics::cached_bytes, Unit::Bytes),
+        field("usage", &MemoryMetrics::usage_percent, Unit::Percent)
+    );
+};
+
+template <>
+struct Schema<DiskMetrics> {
+    static constexpr const char* prefix = "disk";
+    static constexpr auto fields = std::make_tuple(
+        field("device", &DiskMetrics::device, Unit::None, LABEL),
+        field("mount", &DiskMetrics::mount_point, Unit::None, LABEL),
+        field("total", &DiskMetrics::total_bytes, Unit::Bytes),
+        field("used", &DiskMetrics::used_bytes, Unit::Bytes),
+        field("available", &DiskMetrics::available_bytes, Unit::Bytes),
+        field("usage", &DiskMetrics::usage_percent, Unit::Percent),
+        field("read_bytes", &DiskMetrics::read_bytes, Unit::Bytes, COUNTER),
+        field("write_bytes", &DiskMetrics::write_bytes, Unit::Bytes, COUNTER),
+        field("read_ops", &DiskMetrics::read_ops, Unit::None, COUNTER),
+        field("write_ops", &DiskMetrics::write_ops, Unit::None, COUNTER),
+        field("read_bytes_per_sec", &DiskMetrics::read_bytes_per_sec, Unit::BytesPerSecond),
+        field("write_bytes_per_sec", &DiskMetrics::write_bytes_per_sec, Unit::BytesPerSecond),
+        field("read_ops_per_sec", &DiskMetrics::read_ops_per_sec, Unit::PerSecond),
+        field("write_ops_per_sec", &DiskMetrics::write_ops_per_sec, Unit::PerSecond)
+    );
+};
+
+template <>
+struct Schema<SmartMetrics> {
+    static constexpr const char* prefix = "smart";
+    static constexpr auto fields = std::make_tuple(
+        field("device", &SmartMetrics::device, Unit::None, LABEL),
+        field("temperature", &SmartMetrics::temperature, Unit::Celsius),
+        field("power_on_hours", &SmartMetrics::power_on_hours, Unit::Hours),
+        field("reallocated_sectors", &SmartMetrics::reallocated_sectors),
+        field("pending_sectors", &SmartMetrics::pending_sectors),
+        field("health", &SmartMetrics::health_status, Unit::None, INFO),
+        field("passed", &SmartMetrics::passed)
+    );
+};
+
+template <>
+struct Schema<NetworkMetrics> {
+    static constexpr const char* prefix = "network";
+    static constexpr auto fields = std::make_tuple(
+        field("interface", &NetworkMetrics::interface, Unit::None, LABEL),
+        field("rx_bytes", &NetworkMetrics::rx_bytes, Unit::Bytes, COUNTER),
+        field("tx_bytes", &NetworkMetrics::tx_bytes, Unit::Bytes, COUNTER),
+        field("rx_packets", &NetworkMetrics::rx_packets, Unit::None, COUNTER),
+        field("tx_packets", &NetworkMetrics::tx_packets, Unit::None, COUNTER),
+        field("rx_errors", &NetworkMetrics::rx_errors, Unit::None, COUNTER),
+        field("tx_errors", &NetworkMetrics::tx_errors, Unit::None, COUNTER),
+        field("rx_bytes_per_sec", &NetworkMetrics::rx_bytes_per_sec, Unit::BytesPerSecond),
+        field("tx_bytes_per_sec", &NetworkMetrics::tx_bytes_per_sec, Unit::BytesPerSecond),
+        field("rx_packets_per_sec", &NetworkMetrics::rx_packets_per_sec, Unit::PerSecond),
+        field("tx_packets_per_sec", &NetworkMetrics::tx_packets_per_sec, Unit::PerSecond)
+    );
+};
+
+template <>
+struct Schema<SystemdServiceMetrics> {
+    static constexpr const char* prefix = "systemd";
+    static constexpr auto fields = std::make_tuple(
+        field("name", &SystemdServiceMetrics::name, Unit::None, LABEL),
+        field("state", &SystemdServiceMetrics::state, Unit::None, INFO),
+        field("sub_state", &SystemdServiceMetrics::sub_state, Unit::None, INFO),
+        field("active", &SystemdServiceMetrics::active),
+        field("enabled", &SystemdServiceMetrics::enabled)
+    );
+};
+
+template <>
+struct Schema<ContainerMetrics> {
+    static constexpr const char* prefix = "container";
+    static constexpr auto fields = std::make_tuple(
+        field("id", &ContainerMetrics::id, Unit::None, INFO),
+        field("name", &ContainerMetrics::name, Unit::None, LABEL),
+        field("runtime", &ContainerMetrics::runtime, Unit::None, LABEL),
+        field("state", &ContainerMetrics::state, Unit::None, INFO),
+        field("image", &ContainerMetrics::image, Unit::None, INFO),
+        field("cpu_percent", &ContainerMetrics::cpu_percent, Unit::Percent),
+        field("memory_bytes", &ContainerMetrics::memory_bytes, Unit::Bytes),
+        field("memory_limit", &ContainerMetrics::memory_limit, Unit::Bytes),
+        field("memory_percent", &ContainerMetrics::memory_percent, Unit::Percent),
+        field("memory_cache", &ContainerMetrics::memory_cache, Unit::Bytes),
+        field("network_rx_bytes", &ContainerMetrics::network_rx_bytes, Unit::Bytes, COUNTER),
+        field("network_tx_bytes", &ContainerMetrics::network_tx_bytes, Unit::Bytes, COUNTER),
+        field("network_rx_packets", &ContainerMetrics::network_rx_packets, Unit::None, COUNTER),
+        field("network_tx_packets", &ContainerMetrics::network_tx_packets, Unit::None, COUNTER),
+        field("network_rx_errors", &ContainerMetrics::network_rx_errors, Unit::None, COUNTER),
+        field("network_tx_errors", &ContainerMetrics::network_tx_errors, Unit::None, COUNTER),
+        field("network_rx_bytes_per_sec", &ContainerMetrics::network_rx_bytes_per_sec, Unit::BytesPerSecond),
+        field("network_tx_bytes_per_sec", &ContainerMetrics::network_tx_bytes_per_sec, Unit::BytesPerSecond),
+        field("block_read_bytes", &ContainerMetrics::block_read_bytes, Unit::Bytes, COUNTER),
+        field("block_write_bytes", &ContainerMetrics::block_write_bytes, Unit::Bytes, COUNTER),
+        field("block_read_bytes_per_sec", &ContainerMetrics::block_read_bytes_per_sec, Unit::BytesPerSecond),
+        field("block_write_bytes_per_sec", &ContainerMetrics::block_write_bytes_per_sec, Unit::BytesPerSecond),
+        field("pids", &ContainerMetrics::pids)
+    );
+};
+
+template <>
+struct Schema<KubernetesMetrics> {
+    static constexpr const char* prefix = "kubernetes";
+    static constexpr auto fields = std::make_tuple(
+        field("type", &KubernetesMetrics::cluster_type, Unit::None, INFO),
+        field("detected", &KubernetesMetrics::detected),
+        field("pods", &KubernetesMetrics::pod_count),
+        field("nodes", &KubernetesMetrics::node_count),
+        field("namespaces", &KubernetesMetrics::namespaces)
+    );
+};
+
+template <>
+struct Schema<TemperatureMetrics> {
+    static constexpr const char* prefix = "temperature";
+    static constexpr auto fields = std::make_tuple(
+        field("sensor", &TemperatureMetrics::sensor_name, Unit::None, LABEL),
+        field("type", &TemperatureMetrics::sensor_type, Unit::None, LABEL),
+        field("label", &TemperatureMetrics::label, Unit::None, LABEL),
+        field("temp", &TemperatureMetrics::temperature, Unit::Celsius),
+        field("max", &TemperatureMetrics::max, Unit::Celsius, OMIT_IF_ZERO),
+        field("critical", &TemperatureMetrics::critical, Unit::Celsius, OMIT_IF_ZERO)
+    );
+};
+
+template <>
+struct Schema<SystemMetrics> {
+    static constexpr const char* prefix = "";
+    static constexpr auto fields = std::make_tuple(
+        field("timestamp", &SystemMetrics::timestamp, Unit::Seconds),
+        field("hostname", &SystemMetrics::hostname, Unit::None, LABEL),
+        field("uptime", &SystemMetrics::uptime_seconds, Unit::Seconds),
+        field("system_info", &SystemMetrics::system_info, Unit::None, SESSION),
+        field("cpu", &SystemMetrics::cpu),
+        field("memory", &SystemMetrics::memory),
+        field("disks", &SystemMetrics::disks),
+        field("smart", &SystemMetrics::smart_data),
+        field("network", &SystemMetrics::network),
+        field("systemd", &SystemMetrics::systemd_services),
+        field("containers", &SystemMetrics::containers),
+        field("kubernetes", &SystemMetrics::kubernetes),
+        field("temperatures", &SystemMetrics::temperatures)
+    );
+};
+
+template <typename T, typename = void>
+struct has_schema : std::false_type {};
+
+template <typename T>
+struct has_schema<T, std::void_t<decltype(Schema<T>::fields)>> : std::true_type {};
+
+template <typename T>
+struct is_vector : std::false_type {};
+
+template <typename T>
+struct is_vector<std::vector<T>> : std::true_type {};
+
+template <typename T>
+constexpr bool is_number_v = std::is_arithmetic_v<T> && !std::is_same_v<T, bool>;
+
+template <typename T, typename F>
+inline void forEachField(F&& f) {
+    std::apply([&f](const auto&... fields) { (f(fields), ...); }, Schema<T>::fields);
+}
+
+template <typename T>
+inline bool isZero(const T& value) {
+    if constexpr (std::is_arithmetic_v<T>) {
+        return value == T{};
+    } else {
+        return false;
+    }
+}
+
+template <typename T>
+bool equal(const T& a, const T& b);
+
+template <typename T>
+inline bool equalValue(const T& a, const T& b) {
+    if constexpr (has_schema<T>::value) {
+        return equal(a, b);
+    } else if constexpr (is_vector<T>::value) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i) {
+            if (!equalValue(a[i], b[i])) {
+                return false;
+            }
+        }
+        return true;
+    } else {
+        return a == b;
+    }
+}
+
+template <typename T>
+inline bool equal(const T& a, const T& b) {
+    bool same = true;
+    forEachField<T>([&](const auto& f) {
+        same = same && equalValue(a.*(f.member), b.*(f.member));
+    });
+    return same;
+}
+
+// ---------------------------------------------------------------------------
+// Projection
+//
+// Selects parts of a sample for API responses: fields=cpu.usage,disks[*].usage
+// keeps only those fields, and a filter such as mount=/data keeps only the
+// list entries whose LABEL field of that name has that value. Entries of a
+// selected list keep their LABEL fields so they can still be told apart, and
+// the sample keeps its timestamp and hostname.
+
+struct Projection {
+    struct Node {
+        bool all = false;  // the whole value is selected
+        std::map<std::string, Node, std::less<>> children;
+    };
+
+    Node root{true, {}};
+    std::map<std::string, std::string, std::less<>> filters;
+
+    bool selectsAll() const {
+        return root.all && filters.empty();
+    }
+
+    // Adds a dotted path; "[*]" after a list name is optional.
+    void select(std::string_view path) {
+        if (root.all) {
+            root.all = false;
+            root.children["timestamp"].all = true;
+        }
+
+        Node* node = &root;
+        size_t pos = 0;
+        while (pos <= path.size() && !node->all) {
+            size_t end = path.find('.', pos);
+            if (end == std::string_view::npos) {
+                end = path.size();
+            }
+            std::string_view name = path.substr(pos, end - pos);
+            if (name.size() >= 3 && name.compare(name.size() - 3, 3, "[*]") == 0) {
+                name.remove_suffix(3);
+            }
+
+            node = &node->children[std::string(name)];
+            if (end == path.size()) {
+                node->all = true;
+                node->children.clear();
+            }
+            pos = end + 1;
+        }
+    }
+};
+
+template <typename T>
+inline void collectLabelFields(const std::string& path, std::map<std::string, std::vector<std::string>>& out) {
+    forEachField<T>([&](const auto& f) {
+        using V = typename std::decay_t<decltype(f)>::value_type;
+        if (f.flags & LABEL) {
+            out[path].push_back(f.name);
+        }
+
+        std::string child = path.empty() ? std::string(f.name) : path + "." + f.name;
+        if constexpr (has_schema<V>::value) {
+            collectLabelFields<V>(child, out);
+        } else if constexpr (is_vector<V>::value) {
+            if constexpr (has_schema<typename V::value_type>::value) {
+                collectLabelFields<typename V::value_type>(child, out);
+            }
+        }
+    });
+}
+
+// LABEL field names of every record in a sample, by dotted path ("" for the
+// sample itself, "disks" for its disks).
+inline const std::map<std::string, std::vector<std::string>>& labelFields() {
+    static const auto fields = [] {
+        std::map<std::string, std::vector<std::string>> out;
+        collectLabelFields<SystemMetrics>(std::string(), out);
+        return out;
+    }();
+    return fields;
+}
+
+inline std::string percentDecode(std::string_view s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned code = 0;
+        if (s[i] == '%' && i + 2 < s.size() &&
+            std::from_chars(s.data() + i + 1, s.data() + i + 3, code, 16).ptr == s.data() + i + 3) {
+            out.push_back(static_cast<char>(code));
+            i += 2;
+        } else {
+            out.push_back(s[i] == '+' ? ' ' : s[i]);
+        }
+    }
+    return out;
+}
+
+// Builds a projection from a request target's query string: fields= holds a
+// comma-separated list of paths, and any parameter named like a LABEL field
+// is a filter. Other parameters are left to the endpoint.
+inline Projection parseProjection(std::string_view target) {
+    Projection projection;
+    size_t query = target.find('?');
+    if (query == std::string_view::npos) {
+        return projection;
+    }
+
+    std::string_view rest = target.substr(query + 1);
+    while (!rest.empty()) {
+        size_t amp = rest.find('&');
+        std::string_view param = rest.substr(0, amp);
+        rest = amp == std::string_view::npos ? std::string_view() : rest.substr(amp + 1);
+
+        size_t eq = param.find('=');
+        if (eq == std::string_view::npos) {
+            continue;
+        }
+        std::string name = percentDecode(param.substr(0, eq));
+        std::string value = percentDecode(param.substr(eq + 1));
+
+        if (name == "fields") {
+            std::string_view list = value;
+            while (!list.empty()) {
+                size_t comma = list.find(',');
+                if (comma != 0) {
+                    projection.select(list.substr(0, comma));
+                }
+                list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+            }
+            continue;
+        }
+
+        for (const auto& record : labelFields()) {
+            if (std::find(record.second.begin(), record.second.end(), name) != record.second.end()) {
+                projection.filters[name] = value;
+                break;
+            }
+        }
+    }
+    return projection;
+}
+
+// True unless a LABEL field of obj contradicts a filter.
+template <typename T>
+inline bool matchesFilters(const T& obj, const std::map<std::string, std::string, std::less<>>& filters) {
+    bool match = true;
+    if (filters.empty()) {
+        return match;
+    }
+    forEachField<T>([&](const auto& f) {
+        using V = typename std::decay_t<decltype(f)>::value_type;
+        if constexpr (std::is_same_v<V, std::string>) {
+            if (f.flags & LABEL) {
+                auto it = filters.find(std::string_view(f.name));
+                if (it != filters.end() && it->second != obj.*(f.member)) {
+                    match = false;
+                }
+            }
+        }
+    });
+    return match;
+}
+
+// ---------------------------------------------------------------------------
+// JSON
+
+struct WriteOptions {
+    bool include_session = true;
+    const Projection* projection = nullptr;  // everything if null
+};
+
+inline void appendEscaped(std::string& out, std::string_view s) {
+    static const char hex[] = "0123456789abcdef";
+    for (char c : s) {
+        switch (c) {
+            case '"': out.append("\\\""); break;
+            case '\\': out.append("\\\\"); break;
+            case '\n': out.append("\\n"); break;
+            case '\r': out.append("\\r"); break;
+            case '\t': out.append("\\t"); break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out.append("\\u00");
+                    out.push_back(hex[(c >> 4) & 0xF]);
+                    out.push_back(hex[c & 0xF]);
+                } else {
+                    out.push_back(c);
+                }
+        }
+    }
+}
+
+template <typename T>
+inline void appendInteger(std::string& out, T value) {
+    char buf[24];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, result.ptr);
+}
+
+// Doubles are written with two decimals, as the agent always has.
+inline void appendFixed(std::string& out, double value) {
+    if (!std::isfinite(value)) {
+        out.append("null");
+        return;
+    }
+    char buf[64];
+    auto result = std::to_chars(buf, buf + sizeof(buf), value, std::chars_format::fixed, 2);
+    out.append(buf, result.ptr);
+}
+
+template <typename T>
+void writeJSON(std::string& out, const T& obj, const WriteOptions& opts = WriteOptions(),
+               const Projection::Node* node = nullptr);
+
+// node is the projection of this value; null selects all of it.
+template <typename T>
+inline void writeJSONValue(std::string& out, const T& value, const WriteOptions& opts,
+                           const Projection::Node* node = nullptr) {
+    if constexpr (std::is_same_v<T, std::string>) {
+        out.push_back('"');
+        appendEscaped(out, value);
+        out.push_back('"');
+    } else if constexpr (std::is_same_v<T, bool>) {
+        out.append(value ? "true" : "false");
+    } else if constexpr (std::is_integral_v<T>) {
+        appendInteger(out, value);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        appendFixed(out, value);
+    } else if constexpr (is_vector<T>::value) {
+        out.push_back('[');
+        bool first = true;
+        for (const auto& element : value) {
+            if constexpr (has_schema<typename T::value_type>::value) {
+                if (opts.projection && !matchesFilters(element, opts.projection->filters)) {
+                    continue;
+                }
+            }
+            if (!first) out.push_back(',');
+            first = false;
+            writeJSONValue(out, element, opts, node);
+        }
+        out.push_back(']');
+    } else {
+        writeJSON(out, value, opts, node);
+    }
+}
+
+template <typename T>
+inline void writeJSON(std::string& out, const T& obj, const WriteOptions& opts, const Projection::Node* node) {
+    out.push_back('{');
+    bool first = true;
+    forEachField<T>([&](const auto& f) {
+        const auto& value = obj.*(f.member);
+        if ((f.flags & SESSION) && !opts.include_session) {
+            return;
+        }
+        if ((f.flags & OMIT_IF_ZERO) && isZero(value)) {
+            return;
+        }
+
+        // Unselected fields are skipped before anything is formatted.
+        const Projection::Node* child = nullptr;
+        if (node && !(f.flags & LABEL)) {
+            auto it = node->children.find(std::string_view(f.name));
+            if (it == node->children.end()) {
+                return;
+            }
+            child = it->second.all ? nullptr : &it->second;
+        }
+
+        if (!first) out.push_back(',');
+        first = false;
+        out.push_back('"');
+        out.append(f.name);
+        out.append("\":");
+        writeJSONValue(out, value, opts, child);
+    });
+    out.push_back('}');
+}
+
+// Writes the parts of obj the projection selects. Returns false, writing
+// nothing, if obj itself is filtered out.
+template <typename T>
+inline bool writeProjectedJSON(std::string& out, const T& obj, const Projection& projection,
+                               bool include_session = true) {
+    if (!matchesFilters(obj, projection.filters)) {
+        return false;
+    }
+    WriteOptions opts;
+    opts.include_session = include_session;
+    opts.projection = &projection;
+    writeJSON(out, obj, opts, projection.root.all ? nullptr : &projection.root);
+    return true;
+}
+
+// Minimal pull parser for the documents produced above. Unknown keys are
+// skipped so older readers accept newer agents.
+class JsonReader {
+public:
+    explicit JsonReader(std::string_view input) : in_(input), pos_(0), ok_(true) {}
+
+    bool ok() const { return ok_; }
+
+    size_t position() const { return pos_; }
+
+    // Next character after whitespace, without consuming it; 0 at the end.
+    char peek() {
+        skipWhitespace();
+        return pos_ < in_.size() ? in_[pos_] : '\0';
+    }
+
+    bool consume(char c) {
+        skipWhitespace();
+        if (pos_ < in_.size() && in_[pos_] == c) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    bool expect(char c) {
+        if (!consume(c)) {
+            ok_ = false;
+        }
+        return ok_;
+    }
+
+    bool consumeNull() {
+        skipWhitespace();
+        if (in_.compare(pos_, 4, "null") == 0) {
+            pos_ += 4;
+            return true;
+        }
+        return false;
+    }
+
+    bool readString(std::string& out) {
+        out.clear();
+        if (!expect('"')) {
+            return false;
+        }
+        while (pos_ < in_.size()) {
+            char c = in_[pos_++];
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                out.push_back(c);
+                continue;
+            }
+            if (pos_ >= in_.size()) {
+                break;
+            }
+            char esc = in_[pos_++];
+            switch (esc) {
+                case 'n': out.push_back('\n'); break;
+                case 'r': out.push_back('\r'); break;
+                case 't': out.push_back('\t'); break;
+                case 'b': out.push_back('\b'); break;
+                case 'f': out.push_back('\f'); break;
+                case 'u': {
+                    unsigned code = 0;
+                    if (pos_ + 4 > in_.size() ||
+                        std::from_chars(in_.data() + pos_, in_.data() + pos_ + 4, code, 16).ec != std::errc()) {
+                        ok_ = false;
+                        return false;
+                    }
+                    pos_ += 4;
+                    appendUtf8(out, code);
+                    break;
+                }
+                default: out.push_back(esc);
+            }
+        }
+        ok_ = false;
+        return false;
+    }
+
+    bool readBool(bool& out) {
+        skipWhitespace();
+        if (in_.compare(pos_, 4, "true") == 0) {
+            pos_ += 4;
+            out = true;
+        } else if (in_.compare(pos_, 5, "false") == 0) {
+            pos_ += 5;
+            out = false;
+        } else {
+            ok_ = false;
+        }
+        return ok_;
+    }
+
+    template <typename T>
+    bool readNumber(T& out) {
+        skipWhitespace();
+        size_t end = pos_;
+        bool integral = true;
+        while (end < in_.size() && isNumberChar(in_[end])) {
+            if (in_[end] == '.' || in_[end] == 'e' || in_[end] == 'E') {
+                integral = false;
+            }
+            ++end;
+        }
+        const char* first = in_.data() + pos_;
+        const char* last = in_.data() + end;
+
+        std::from_chars_result result{};
+        if constexpr (std::is_integral_v<T>) {
+            if (integral) {
+                result = std::from_chars(first, last, out);
+            } else {
+                double d = 0;
+                result = std::from_chars(first, last, d);
+                out = static_cast<T>(d);
+            }
+        } else {
+            result = std::from_chars(first, last, out);
+        }
+
+        if (result.ec != std::errc() || result.ptr != last) {
+            ok_ = false;
+        }
+        pos_ = end;
+        return ok_;
+    }
+
+    void skipValue() {
+        skipWhitespace();
+        if (pos_ >= in_.size()) {
+            ok_ = false;
+            return;
+        }
+        char c = in_[pos_];
+        if (c == '"') {
+            std::string ignored;
+            readString(ignored);
+        } else if (c == '{' || c == '[') {
+            char close = c == '{' ? '}' : ']';
+            ++pos_;
+            if (consume(close)) {
+                return;
+            }
+            do {
+                if (c == '{') {
+                    std::string ignored;
+                    if (!readString(ignored) || !expect(':')) {
+                        return;
+                    }
+                }
+                skipValue();
+            } while (ok_ && consume(','));
+            expect(close);
+        } else if (c == 't' || c == 'f') {
+            bool ignored;
+            readBool(ignored);
+        } else if (!consumeNull()) {
+            double ignored;
+            readNumber(ignored);
+        }
+    }
+
+private:
+    std::string_view in_;
+    size_t pos_;
+    bool ok_;
+
+    void skipWhitespace() {
+        while (pos_ < in_.size() &&
+               (in_[pos_] == ' ' || in_[pos_] == '\t' || in_[pos_] == '\n' || in_[pos_] == '\r')) {
+            ++pos_;
+        }
+    }
+
+    static bool isNumberChar(char c) {
+        return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+    }
+
+    static void appendUtf8(std::string& out, unsigned code) {
+        if (code < 0x80) {
+            out.push_back(static_cast<char>(code));
+        } else if (code < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        } else {
+            out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+            out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+    }
+};
+
+template <typename T>
+bool readJSON(JsonReader& reader, T& obj);
+
+template <typename T>
+inline bool readJSONValue(JsonReader& reader, T& value) {
+    if (reader.consumeNull()) {
+        return true;
+    }
+    if constexpr (std::is_same_v<T, std::string>) {
+        return reader.readString(value);
+    } else if constexpr (std::is_same_v<T, bool>) {
+        return reader.readBool(value);
+    } else if constexpr (std::is_arithmetic_v<T>) {
+        return reader.readNumber(value);
+    } else if constexpr (is_vector<T>::value) {
+        value.clear();
+        if (!reader.expect('[')) {
+            return false;
+        }
+        if (reader.consume(']')) {
+            return true;
+        }
+        do {
+            value.emplace_back();
+            if (!readJSONValue(reader, value.back())) {
+                return false;
+            }
+        } while (reader.consume(','));
+        return reader.expect(']');
+    } else {
+        return readJSON(reader, value);
+    }
+}
+
+template <typename T>
+inline bool readJSON(JsonReader& reader, T& obj) {
+    if (!reader.expect('{')) {
+        return false;
+    }
+    if (reader.consume('}')) {
+        return true;
+    }
+
+    std::string key;
+    do {
+        if (!reader.readString(key) || !reader.expect(':')) {
+            return false;
+        }
+
+        bool matched = false;
+        forEachField<T>([&](const auto& f) {
+            if (!matched && key == f.name) {
+                matched = true;
+                readJSONValue(reader, obj.*(f.member));
+            }
+        });
+        if (!matched) {
+            reader.skipValue();
+        }
+    } while (reader.ok() && reader.consume(','));
+
+    return reader.expect('}');
+}
+
+// Copies the parts of a JSON sample written by writeJSON that the projection
+// selects. Selected values are copied verbatim; unselected members and
+// whole records that fail a filter are only skipped over, never parsed.
+// path is the dotted path of the value within the sample. Returns false,
+// writing nothing, if the value is filtered out.
+inline bool projectJSONValue(std::string_view in, std::string& out, const Projection& projection,
+                             const Projection::Node* node, const std::string& path) {
+    JsonReader reader(in);
+    char c = reader.peek();
+
+    if ((node == nullptr && projection.filters.empty()) || (c != '{' && c != '[')) {
+        out.append(in.substr(reader.position()));
+        return true;
+    }
+
+    struct Member {
+        std::string key;
+        std::string_view value;
+    };
+    std::vector<Member> members;
+    std::vector<std::string_view> elements;
+
+    reader.consume(c);
+    char close = c == '{' ? '}' : ']';
+    if (!reader.consume(close)) {
+        do {
+            Member member;
+            if (c == '{' && (!reader.readString(member.key) || !reader.expect(':'))) {
+                break;
+            }
+            reader.peek();
+            size_t start = reader.position();
+            reader.skipValue();
+            member.value = in.substr(start, reader.position() - start);
+            if (c == '{') {
+                members.push_back(std::move(member));
+            } else {
+                elements.push_back(member.value);
+            }
+        } while (reader.ok() && reader.consume(','));
+        reader.expect(close);
+    }
+
+    if (!reader.ok()) {
+        out.append(in);
+        return true;
+    }
+
+    if (c == '[') {
+        out.push_back('[');
+        bool first = true;
+        for (auto element : elements) {
+            size_t mark = out.size();
+            if (!first) out.push_back(',');
+            if (projectJSONValue(element, out, projection, node, path)) {
+                first = false;
+            } else {
+                out.resize(mark);
+            }
+        }
+        out.push_back(']');
+        return true;
+    }
+
+    const std::vector<std::string>* labels = nullptr;
+    auto record = labelFields().find(path);
+    if (record != labelFields().end()) {
+        labels = &record->second;
+    }
+    auto is_label = [labels](const std::string& key) {
+        return labels && std::find(labels->begin(), labels->end(), key) != labels->end();
+    };
+
+    for (const auto& member : members) {
+        auto filter = projection.filters.find(member.key);
+        if (filter != projection.filters.end() && is_label(member.key)) {
+            std::string value;
+            JsonReader label(member.value);
+            if (!label.readString(value) || value != filter->second) {
+                return false;
+            }
+        }
+    }
+
+    out.push_back('{');
+    bool first = true;
+    for (const auto& member : members) {
+        const Projection::Node* child = nullptr;
+        if (node && !is_label(member.key)) {
+            auto it = node->children.find(member.key);
+            if (it == node->children.end()) {
+                continue;
+            }
+            child = it->second.all ? nullptr : &it->second;
+        }
+
+        if (!first) out.push_back(',');
+        first = false;
+        out.push_back('"');
+        appendEscaped(out, member.key);
+        out.append("\":");
+        projectJSONValue(member.value, out, projection, child,
+                         path.empty() ? member.key : path + "." + member.key);
+    }
+    out.push_back('}');
+    return true;
+}
+
+inline bool projectJSON(std::string_view json, std::string& out, const Projection& projection) {
+    return projectJSONValue(json, out, projection, projection.root.all ? nullptr : &projection.root,
+                            std::string());
+}
+
+// ---------------------------------------------------------------------------
+// Binary codec
+//
+// Fields are written in schema order: integers as LEB128 varints (zigzag for
+// signed), doubles as 8 little-endian bytes, strings and lists with a varint
+// length. Every struct is prefixed with its encoded size in 4 little-endian
+// bytes, so readers skip fields appended by newer writers.
+
+inline void putVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+inline void putFixed(std::string& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; ++i) {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+    }
+}
+
+class BinaryReader {
+public:
+    explicit BinaryReader(std::string_view input) : in_(input), pos_(0), ok_(true) {}
+
+    bool ok() const { return ok_; }
+    size_t position() const { return pos_; }
+    void seek(size_t pos) { pos_ = pos <= in_.size() ? pos : in_.size(); }
+
+    uint64_t getVarint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos_ >= in_.size()) {
+                ok_ = false;
+                return 0;
+            }
+            uint8_t byte = static_cast<uint8_t>(in_[pos_++]);
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        ok_ = false;
+        return 0;
+    }
+
+    uint64_t getFixed(int bytes) {
+        if (in_.size() - pos_ < static_cast<size_t>(bytes)) {
+            ok_ = false;
+            pos_ = in_.size();
+            return 0;
+        }
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; ++i) {
+            value |= static_cast<uint64_t>(static_cast<uint8_t>(in_[pos_ + i])) << (i * 8);
+        }
+        pos_ += bytes;
+        return value;
+    }
+
+    std::string_view getBytes(size_t len) {
+        if (in_.size() - pos_ < len) {
+            ok_ = false;
+            pos_ = in_.size();
+            return {};
+        }
+        std::string_view bytes = in_.substr(pos_, len);
+        pos_ += len;
+        return bytes;
+    }
+
+private:
+    std::string_view in_;
+    size_t pos_;
+    bool ok_;
+};
+
+template <typename T>
+void encodeBinary(std::string& out, const T& obj, const WriteOptions& opts = WriteOptions());
+
+template <typename T>
+inline void encodeBinaryValue(std::string& out, const T& value, const WriteOptions& opts) {
+    if constexpr (std::is_same_v<T, std::string>) {
+        putVarint(out, value.size());
+        out.append(value);
+    } else if constexpr (std::is_same_v<T, bool>) {
+        out.push_back(value ? 1 : 0);
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+        int64_t v = value;
+        putVarint(out, (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63));
+    } else if constexpr (std::is_integral_v<T>) {
+        putVarint(out, value);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        double d = value;
+        uint64_t bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        putFixed(out, bits, 8);
+    } else if constexpr (is_vector<T>::value) {
+        putVarint(out, value.size());
+        for (const auto& item : value) {
+            encodeBinaryValue(out, item, opts);
+        }
+    } else {
+        encodeBinary(out, value, opts);
+    }
+}
+
+template <typename T>
+inline void encodeBinary(std::string& out, const T& obj, const WriteOptions& opts) {
+    size_t size_pos = out.size();
+    out.append(4, '\0');
+
+    forEachField<T>([&](const auto& f) {
+        using V = typename std::decay_t<decltype(f)>::value_type;
+        if ((f.flags & SESSION) && !opts.include_session) {
+            encodeBinaryValue(out, V{}, opts);
+        } else {
+            encodeBinaryValue(out, obj.*(f.member), opts);
+        }
+    });
+
+    uint32_t size = static_cast<uint32_t>(out.size() - size_pos - 4);
+    for (int i = 0; i < 4; ++i) {
+        out[size_pos + i] = static_cast<char>((size >> (i * 8)) & 0xFF);
+    }
+}
+
+template <typename T>
+bool decodeBinary(BinaryReader& reader, T& obj);
+
+template <typename T>
+inline void decodeBinaryValue(BinaryReader& reader, T& value) {
+    if constexpr (std::is_same_v<T, std::string>) {
+        size_t len = reader.getVarint();
+        value = std::string(reader.getBytes(len));
+    } else if constexpr (std::is_same_v<T, bool>) {
+        value = reader.getFixed(1) != 0;
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+        uint64_t z = reader.getVarint();
+        value = static_cast<T>(static_cast<int64_t>(z >> 1) ^ -static_cast<int64_t>(z & 1));
+    } else if constexpr (std::is_integral_v<T>) {
+        value = static_cast<T>(reader.getVarint());
+    } else if constexpr (std::is_floating_point_v<T>) {
+        uint64_t bits = reader.getFixed(8);
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        value = static_cast<T>(d);
+    } else if constexpr (is_vector<T>::value) {
+        size_t count = reader.getVarint();
+        value.clear();
+        for (size_t i = 0; i < count && reader.ok(); ++i) {
+            value.emplace_back();
+            decodeBinaryValue(reader, value.back());
+        }
+    } else {
+        decodeBinary(reader, value);
+    }
+}
+
+template <typename T>
+inline bool decodeBinary(BinaryReader& reader, T& obj) {
+    size_t size = reader.getFixed(4);
+    size_t end = reader.position() + size;
+
+    forEachField<T>([&](const auto& f) {
+        if (reader.ok() && reader.position() < end) {
+            decodeBinaryValue(reader, obj.*(f.member));
+        }
+    });
+
+    if (reader.position() > end) {
+        return false;
+    }
+    reader.seek(end);
+    return reader.ok();
+}
+
+// ---------------------------------------------------------------------------
+// Numeric series
+//
+// Flattens a sample into one value per numeric field for column-oriented
+// storage. A series is named by its dotted JSON path ("disks.usage"); series
+// sharing a path are told apart by the LABEL fields of their records, given
+// as the body of a JSON object ("device":"sda1","mount":"/"). Host inventory
+// and the sample timestamp are not series.
+
+template <typename T, typename F>
+inline void forEachSeries(const T& obj, const std::string& path, const std::string& parent_labels, F& f) {
+    std::string labels = parent_labels;
+    forEachField<T>([&](const auto& field) {
+        using V = typename std::decay_t<decltype(field)>::value_type;
+        if constexpr (std::is_same_v<V, std::string>) {
+            if ((field.flags & LABEL) && !path.empty()) {
+                if (!labels.empty()) labels.push_back(',');
+                labels.push_back('"');
+                labels.append(field.name);
+                labels.append("\":\"");
+                appendEscaped(labels, obj.*(field.member));
+                labels.push_back('"');
+            }
+        }
+    });
+
+    forEachField<T>([&](const auto& field) {
+        using V = typename std::decay_t<decltype(field)>::value_type;
+        if (field.flags & SESSION) {
+            return;
+        }
+
+        std::string name = path.empty() ? std::string(field.name) : path + "." + field.name;
+        if constexpr (std::is_arithmetic_v<V>) {
+            if (!path.empty() || name != "timestamp") {
+                f(name, labels, static_cast<double>(obj.*(field.member)));
+            }
+        } else if constexpr (has_schema<V>::value) {
+            forEachSeries(obj.*(field.member), name, labels, f);
+        } else if constexpr (is_vector<V>::value) {
+            using E = typename V::value_type;
+            if constexpr (has_schema<E>::value) {
+                for (const auto& child : obj.*(field.member)) {
+                    forEachSeries(child, name, labels, f);
+                }
+            }
+        }
+    });
+}
+
+// Calls f(path, labels, value) for every numeric field of the sample.
+template <typename F>
+inline void forEachSeries(const SystemMetrics& sample, F&& f) {
+    forEachSeries(sample, std::string(), std::string(), f);
+}
+
+// ---------------------------------------------------------------------------
+// Prometheus text exposition
+//
+// Series are named blinky_<prefix>_<field>[_<unit>][_total]. LABEL fields
+// label every series of their record, INFO fields are exported as labels of
+// a constant <prefix>_info series. Families are written field by field
+// across all records so each one forms a single group, as the format
+// requires.
+
+inline const char* unitSuffix(Unit unit) {
+    switch (unit) {
+        case Unit::Percent: return "_percent";
+        case Unit::Bytes: return "_bytes";
+        case Unit::Seconds: return "_seconds";
+        case Unit::Hours: return "_hours";
+        case Unit::Celsius: return "_celsius";
+        default: return "";
+    }
+}
+
+inline void appendLabel(std::string& labels, const char* name, std::string_view value) {
+    if (!labels.empty()) labels.push_back(',');
+    labels.append(name);
+    labels.append("=\"");
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            labels.push_back('\\');
+            labels.push_back(c);
+        } else if (c == '\n') {
+            labels.append("\\n");
+        } else {
+            labels.push_back(c);
+        }
+    }
+    labels.push_back('"');
+}
+
+template <typename T>
+inline std::string recordLabels(const T& obj, const std::string& parent, uint8_t kind) {
+    std::string labels = parent;
+    forEachField<T>([&](const auto& f) {
+        using V = typename std::decay_t<decltype(f)>::value_type;
+        if constexpr (std::is_same_v<V, std::string>) {
+            if (f.flags & kind) {
+                appendLabel(labels, f.name, obj.*(f.member));
+            }
+        }
+    });
+    return labels;
+}
+
+template <typename T>
+using Records = std::vector<std::pair<const T*, std::string>>;
+
+template <typename T>
+inline void writePrometheusFamilies(std::string& out, const std::string& name_prefix, const Records<T>& records) {
+    if (records.empty()) {
+        return;
+    }
+
+    bool has_info = false;
+    forEachField<T>([&](const auto& f) {
+        has_info = has_info || (f.flags & INFO);
+    });
+    if (has_info) {
+        out.append("# TYPE ").append(name_prefix).append("_info gauge\n");
+        for (const auto& record : records) {
+            out.append(name_prefix).append("_info{");
+            out.append(recordLabels(*record.first, record.second, INFO));
+            out.append("} 1\n");
+        }
+    }
+
+    forEachField<T>([&](const auto& f) {
+        using V = typename std::decay_t<decltype(f)>::value_type;
+
+        if constexpr (std::is_arithmetic_v<V>) {
+            std::string name = name_prefix + "_" + f.name;
+            const char* suffix = unitSuffix(f.unit);
+            size_t suffix_len = std::strlen(suffix);
+            if (suffix_len > 0 &&
+                (name.size() < suffix_len || name.compare(name.size() - suffix_len, suffix_len, suffix) != 0)) {
+                name.append(suffix);
+            }
+            if (f.flags & COUNTER) {
+                name.append("_total");
+            }
+
+            out.append("# TYPE ").append(name).append((f.flags & COUNTER) ? " counter\n" : " gauge\n");
+            for (const auto& record : records) {
+                const V& value = record.first->*(f.member);
+                if ((f.flags & OMIT_IF_ZERO) && isZero(value)) {
+                    continue;
+                }
+                out.append(name);
+                if (!record.second.empty()) {
+                    out.push_back('{');
+                    out.append(record.second);
+                    out.push_back('}');
+                }
+                out.push_back(' ');
+                if constexpr (std::is_same_v<V, bool>) {
+                    out.push_back(value ? '1' : '0');
+                } else if constexpr (std::is_integral_v<V>) {
+                    appendInteger(out, value);
+                } else {
+                    if (std::isfinite(value)) {
+                        char buf[64];
+                        auto result = std::to_chars(buf, buf + sizeof(buf), static_cast<double>(value));
+                        out.append(buf, result.ptr);
+                    } else {
+                        out.append("NaN");
+                    }
+                }
+                out.push_back('\n');
+            }
+        } else if constexpr (has_schema<V>::value) {
+            Records<V> children;
+            children.reserve(records.size());
+            for (const auto& record : records) {
+                const V& child = record.first->*(f.member);
+                children.emplace_back(&child, recordLabels(child, record.second, LABEL));
+            }
+            writePrometheusFamilies(out, std::string("blinky_") + Schema<V>::prefix, children);
+        } else if constexpr (is_vector<V>::value) {
+            using E = typename V::value_type;
+            if constexpr (has_schema<E>::value) {
+                Records<E> children;
+                for (const auto& record : records) {
+                    for (const auto& child : record.first->*(f.member)) {
+                        children.emplace_back(&child, recordLabels(child, record.second, LABEL));
+                    }
+                }
+                writePrometheusFamilies(out, std::string("blinky_") + Schema<E>::prefix, children);
+            }
+        }
+    });
+}
+
+// Writes one exposition covering all given samples, e.g. every host known
+// to the collector.
+inline void writePrometheus(std::string& out, const std::vector<const SystemMetrics*>& samples) {
+    Records<SystemMetrics> records;
+    records.reserve(samples.size());
+    for (const auto* sample : samples) {
+        records.emplace_back(sample, recordLabels(*sample, std::string(), LABEL));
+    }
+    writePrometheusFamilies(out, "blinky", records);
+}
+
+}
+}
+}
+
+#endif
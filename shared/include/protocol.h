@@ -2,6 +2,7 @@
 #define BLINKY_PROTOCOL_H
 
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include <vector>
 
@@ -13,12 +14,28 @@ enum class MessageType : uint8_t {
     METRICS = 0x02,
     ALERT = 0x03,
     COMMAND = 0x04,
-    RESPONSE = 0x05
+    RESPONSE = 0x05,
+    SESSION = 0x06,
+    METRICS_BATCH = 0x07
 };
 
+// Binary frame layout, integers in network byte order:
+//
+//   u8  frame version    u8  type          u16 flags
+//   u64 timestamp        u64 sequence
+//   u16 hostname length  u16 version length  u32 payload length
+//   hostname bytes | version bytes | payload bytes
+constexpr uint8_t FRAME_VERSION = 1;
+constexpr size_t FRAME_HEADER_SIZE = 28;
+
+// Payload (and batch entries) use the schema binary codec instead of JSON.
+constexpr uint16_t FLAG_BINARY_PAYLOAD = 0x0001;
+
 struct Message {
     MessageType type;
+    uint16_t flags = 0;
     uint64_t timestamp;
+    uint64_t sequence = 0;
     std::string hostname;
     std::string version;
     std::string payload;
@@ -27,6 +44,30 @@ struct Message {
     static Message deserialize(const std::string& data);
 };
 
+// Decoded frame whose string fields point into the received buffer. The
+// buffer must outlive the view.
+struct MessageView {
+    MessageType type;
+    uint16_t flags = 0;
+    uint64_t timestamp = 0;
+    uint64_t sequence = 0;
+    std::string_view hostname;
+    std::string_view version;
+    std::string_view payload;
+    
+    static bool decode(std::string_view frame, MessageView& out);
+};
+
+// METRICS_BATCH payload: a sequence of samples, each encoded as
+//   u64 timestamp | u32 length | sample payload bytes
+struct BatchEntry {
+    uint64_t timestamp;
+    std::string_view payload;
+};
+
+void appendBatchEntry(std::string& batch, uint64_t timestamp, std::string_view payload);
+bool decodeBatch(std::string_view batch, std::vector<BatchEntry>& out);
+
 }
 }
 
@@ -0,0 +1,268 @@
+#ifndef BLINKY_SHM_METRICS_H
+#define BLINKY_SHM_METRICS_H
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+namespace blinky {
+namespace shm {
+
+// Layout of the shared-memory segment the agent publishes every sample to
+// (/dev/shm/blinky-metrics by default). Processes on the same host read the
+// latest sample straight from the mapping, without a syscall or a socket.
+// Integers are in the host's native byte order.
+//
+//   SegmentHeader   64 bytes
+//   slot 0          SlotHeader | Sample | payload_capacity bytes
+//   slot 1          same
+//
+// The two slots form a double buffer. SegmentHeader::published counts the
+// samples written; the latest one is in slot (published & 1) and the writer
+// always fills the other slot. Each slot also carries a sequence number
+// that is odd while the slot is being written. A reader copies the sample
+// and accepts it only if that number was even and unchanged around the
+// copy, so it can only have to retry when two samples are published during
+// one read.
+//
+// Sample holds the headline numbers in a fixed layout. The payload is the
+// full sample encoded with SystemMetrics::toBinary(), for readers that link
+// the schema.
+//
+// A restarted agent builds a new segment and renames it over the old path,
+// so existing mappings stay valid; reopenIfReplaced() moves a reader over.
+
+constexpr const char* DEFAULT_PATH = "/dev/shm/blinky-metrics";
+constexpr uint32_t MAGIC = 0x534B4C42;  // "BLKS"
+constexpr uint32_t FORMAT_VERSION = 1;
+
+constexpr uint32_t STATE_LIVE = 1;
+constexpr uint32_t STATE_CLOSED = 2;
+
+constexpr uint32_t FLAG_PAYLOAD_TRUNCATED = 0x0001;
+
+constexpr size_t HOSTNAME_SIZE = 64;
+constexpr int MAX_READ_ATTEMPTS = 64;
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shared-memory counters must be lock-free");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared-memory counters must be lock-free");
+
+struct alignas(64) SegmentHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t slot_size;
+    uint32_t payload_capacity;
+    std::atomic<uint32_t> state;
+    uint64_t writer_pid;
+    std::atomic<uint64_t> published;
+};
+
+struct Sample {
+    uint64_t sequence;              // same as SegmentHeader::published
+    uint64_t timestamp;             // seconds since the epoch
+    uint64_t uptime_seconds;
+    double cpu_usage_percent;
+    double load_1min;
+    double load_5min;
+    double load_15min;
+    uint32_t cpu_cores;
+    uint32_t flags;
+    uint64_t memory_total_bytes;
+    uint64_t memory_used_bytes;
+    uint64_t memory_available_bytes;
+    uint64_t memory_cached_bytes;
+    double memory_usage_percent;
+    double disk_max_usage_percent;  // fullest mounted filesystem
+    double network_rx_bytes_per_sec;
+    double network_tx_bytes_per_sec;
+    double temperature_max;
+    uint32_t disk_count;
+    uint32_t network_count;
+    uint32_t container_count;
+    uint32_t containers_running;
+    uint32_t services_failed;
+    uint32_t payload_size;
+    char hostname[HOSTNAME_SIZE];   // NUL-terminated
+};
+
+struct alignas(64) SlotHeader {
+    std::atomic<uint64_t> sequence;
+};
+
+static_assert(sizeof(SegmentHeader) == 64, "SegmentHeader layout changed");
+static_assert(sizeof(SlotHeader) == 64, "SlotHeader layout changed");
+static_assert(sizeof(Sample) == 224, "Sample layout changed");
+static_assert(std::is_trivially_copyable<Sample>::value, "Sample must be trivially copyable");
+
+constexpr size_t SAMPLE_OFFSET = sizeof(SlotHeader);
+constexpr size_t PAYLOAD_OFFSET = SAMPLE_OFFSET + sizeof(Sample);
+
+inline size_t slotSize(size_t payload_capacity) {
+    return (PAYLOAD_OFFSET + payload_capacity + 63) & ~size_t(63);
+}
+
+inline size_t segmentSize(size_t payload_capacity) {
+    return sizeof(SegmentHeader) + 2 * slotSize(payload_capacity);
+}
+
+// Maps a published segment read-only and reads the latest sample from it.
+// read() and readPayload() make no syscalls; open() and reopenIfReplaced()
+// do. Not thread-safe for open/close; concurrent reads are fine.
+class Reader {
+public:
+    explicit Reader(std::string path = DEFAULT_PATH) : path_(std::move(path)) {}
+
+    ~Reader() {
+        close();
+    }
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    bool open() {
+        close();
+
+        int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SegmentHeader)) {
+            ::close(fd);
+            return false;
+        }
+
+        void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            return false;
+        }
+
+        const auto* header = static_cast<const SegmentHeader*>(addr);
+        if (header->magic != MAGIC || header->version != FORMAT_VERSION ||
+            header->header_size != sizeof(SegmentHeader) ||
+            header->slot_size < PAYLOAD_OFFSET + header->payload_capacity ||
+            sizeof(SegmentHeader) + 2 * static_cast<size_t>(header->slot_size) > static_cast<size_t>(st.st_size)) {
+            munmap(addr, st.st_size);
+            return false;
+        }
+
+        base_ = static_cast<const char*>(addr);
+        size_ = st.st_size;
+        slot_size_ = header->slot_size;
+        payload_capacity_ = header->payload_capacity;
+        inode_ = st.st_ino;
+        device_ = st.st_dev;
+        return true;
+    }
+
+    void close() {
+        if (base_) {
+            munmap(const_cast<char*>(base_), size_);
+            base_ = nullptr;
+            size_ = 0;
+        }
+    }
+
+    bool isOpen() const {
+        return base_ != nullptr;
+    }
+
+    // True once the agent that owns the segment has shut down.
+    bool isClosed() const {
+        return !base_ || header()->state.load(std::memory_order_acquire) == STATE_CLOSED;
+    }
+
+    // Reopens the path if the agent restarted and replaced the segment.
+    // Returns true if a segment is mapped afterwards.
+    bool reopenIfReplaced() {
+        struct stat st;
+        if (stat(path_.c_str(), &st) != 0) {
+            return false;
+        }
+        if (base_ && st.st_ino == inode_ && st.st_dev == device_) {
+            return true;
+        }
+        return open();
+    }
+
+    // Copies the latest sample. False if nothing was published yet, the
+    // writer has shut down, or the copy kept racing with the writer.
+    bool read(Sample& sample) const {
+        return readSlot(sample, nullptr);
+    }
+
+    // Same as read(), and also copies the full encoded sample. payload is
+    // left empty if the sample did not fit the segment.
+    bool readPayload(std::string& payload, Sample* sample = nullptr) const {
+        Sample local;
+        return readSlot(sample ? *sample : local, &payload);
+    }
+
+private:
+    std::string path_;
+    const char* base_ = nullptr;
+    size_t size_ = 0;
+    // Copied from the header once open() has checked them against the
+    // mapping; the header stays writable by the agent, so reads never trust
+    // it again for offsets.
+    size_t slot_size_ = 0;
+    size_t payload_capacity_ = 0;
+    ino_t inode_ = 0;
+    dev_t device_ = 0;
+
+    const SegmentHeader* header() const {
+        return reinterpret_cast<const SegmentHeader*>(base_);
+    }
+
+    bool readSlot(Sample& sample, std::string* payload) const {
+        if (!base_) {
+            return false;
+        }
+
+        const SegmentHeader* h = header();
+        for (int attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt) {
+            if (h->state.load(std::memory_order_acquire) != STATE_LIVE) {
+                return false;
+            }
+            uint64_t published = h->published.load(std::memory_order_acquire);
+            if (published == 0) {
+                return false;
+            }
+
+            const char* slot = base_ + sizeof(SegmentHeader) + (published & 1) * slot_size_;
+            const auto* slot_header = reinterpret_cast<const SlotHeader*>(slot);
+
+            uint64_t before = slot_header->sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+
+            std::memcpy(&sample, slot + SAMPLE_OFFSET, sizeof(Sample));
+            if (payload) {
+                size_t size = sample.payload_size <= payload_capacity_ ? sample.payload_size : 0;
+                payload->assign(slot + PAYLOAD_OFFSET, size);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot_header->sequence.load(std::memory_order_relaxed) == before) {
+                sample.hostname[HOSTNAME_SIZE - 1] = '\0';
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+}
+}
+
+#endif
@@ -1,36 +1,132 @@
 #include "protocol.h"
-#include <sstream>
-#include <ctime>
+#include <stdexcept>
 
 namespace blinky {
 namespace protocol {
 
+namespace {
+
+void putUint(std::string& out, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; --i) {
+        out.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+    }
+}
+
+uint64_t getUint(const char* data, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value = (value << 8) | static_cast<unsigned char>(data[i]);
+    }
+    return value;
+}
+
+}
+
 std::string Message::serialize() const {
-    std::ostringstream oss;
-    oss << static_cast<int>(type) << "|"
-        << timestamp << "|"
-        << hostname << "|"
-        << version << "|"
-        << payload;
-    return oss.str();
+    if (hostname.size() > UINT16_MAX || version.size() > UINT16_MAX ||
+        payload.size() > UINT32_MAX) {
+        throw std::length_error("message field too large for frame");
+    }
+    
+    std::string frame;
+    frame.reserve(FRAME_HEADER_SIZE + hostname.size() + version.size() + payload.size());
+    
+    putUint(frame, FRAME_VERSION, 1);
+    putUint(frame, static_cast<uint8_t>(type), 1);
+    putUint(frame, flags, 2);
+    putUint(frame, timestamp, 8);
+    putUint(frame, sequence, 8);
+    putUint(frame, hostname.size(), 2);
+    putUint(frame, version.size(), 2);
+    putUint(frame, payload.size(), 4);
+    
+    frame.append(hostname);
+    frame.append(version);
+    frame.append(payload);
+    
+    return frame;
 }
 
 Message Message::deserialize(const std::string& data) {
+    MessageView view;
+    if (!MessageView::decode(data, view)) {
+        throw std::runtime_error("malformed message frame");
+    }
+    
     Message msg;
-    std::istringstream iss(data);
-    std::string token;
+    msg.type = view.type;
+    msg.flags = view.flags;
+    msg.timestamp = view.timestamp;
+    msg.sequence = view.sequence;
+    msg.hostname = std::string(view.hostname);
+    msg.version = std::string(view.version);
+    msg.payload = std::string(view.payload);
     
-    std::getline(iss, token, '|');
-    msg.type = static_cast<MessageType>(std::stoi(token));
+    return msg;
+}
+
+bool MessageView::decode(std::string_view frame, MessageView& out) {
+    if (frame.size() < FRAME_HEADER_SIZE) {
+        return false;
+    }
     
-    std::getline(iss, token, '|');
-    msg.timestamp = std::stoull(token);
+    const char* p = frame.data();
+    if (getUint(p, 1) != FRAME_VERSION) {
+        return false;
+    }
     
-    std::getline(iss, msg.hostname, '|');
-    std::getline(iss, msg.version, '|');
-    std::getline(iss, msg.payload);
+    out.type = static_cast<MessageType>(getUint(p + 1, 1));
+    out.flags = static_cast<uint16_t>(getUint(p + 2, 2));
+    out.timestamp = getUint(p + 4, 8);
+    out.sequence = getUint(p + 12, 8);
     
-    return msg;
+    size_t hostname_len = getUint(p + 20, 2);
+    size_t version_len = getUint(p + 22, 2);
+    size_t payload_len = getUint(p + 24, 4);
+    
+    if (frame.size() - FRAME_HEADER_SIZE != hostname_len + version_len + payload_len) {
+        return false;
+    }
+    
+    out.hostname = frame.substr(FRAME_HEADER_SIZE, hostname_len);
+    out.version = frame.substr(FRAME_HEADER_SIZE + hostname_len, version_len);
+    out.payload = frame.substr(FRAME_HEADER_SIZE + hostname_len + version_len, payload_len);
+    
+    return true;
+}
+
+void appendBatchEntry(std::string& batch, uint64_t timestamp, std::string_view payload) {
+    if (payload.size() > UINT32_MAX) {
+        throw std::length_error("batch entry too large");
+    }
+    
+    putUint(batch, timestamp, 8);
+    putUint(batch, payload.size(), 4);
+    batch.append(payload);
+}
+
+bool decodeBatch(std::string_view batch, std::vector<BatchEntry>& out) {
+    size_t pos = 0;
+    while (pos < batch.size()) {
+        if (batch.size() - pos < 12) {
+            return false;
+        }
+        
+        BatchEntry entry;
+        entry.timestamp = getUint(batch.data() + pos, 8);
+        size_t len = getUint(batch.data() + pos + 8, 4);
+        pos += 12;
+        
+        if (batch.size() - pos < len) {
+            return false;
+        }
+        
+        entry.payload = batch.substr(pos, len);
+        pos += len;
+        out.push_back(entry);
+    }
+    
+    return true;
 }
 
 }